@@ -0,0 +1,200 @@
+// Batched datagram sends over loopback. One OSCSender pushes bursts of
+// samples to two local UDP receivers, so the I/O thread hands every drain
+// tick to one sendmmsg() call on Linux (async_send_to() elsewhere). Each
+// receiver has to get every datagram byte-identical to makePacket() and
+// in push order, otherwise the run fails. On Linux it also fails if a
+// burst took more sendmmsg() calls than it could straddle drain ticks.
+#include "bench.hpp"
+#include <OSCSender.cpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(OSC_USE_SENDMMSG)
+#include <sys/syscall.h>
+#endif
+
+const size_t kBursts = 256;
+// Below the transport's buffer pool, so nothing is dropped by design.
+const size_t kBurstSize = 48;
+const char* const kAddress = "/batch";
+const std::chrono::seconds kTimeout(5);
+// Both receivers are IPv4, so one call per burst, or two when the burst
+// was still being pushed as a drain tick started.
+const size_t kMaxSendCallsPerBurst = 2;
+
+class DatagramReceiver {
+  public:
+  DatagramReceiver(): _count(0) {
+    _datagrams.reserve(kBursts * kBurstSize);
+    _socket.start([this] (const char* data, size_t size) {
+      _datagrams.emplace_back(data, size);
+      _count.store(_datagrams.size(), std::memory_order_release);
+    });
+  }
+
+  uint16_t port() const {
+    return _socket.port();
+  }
+
+  size_t count() const {
+    return _count.load(std::memory_order_acquire);
+  }
+
+  // Only complete up to count().
+  const std::vector<std::string>& datagrams() const {
+    return _datagrams;
+  }
+
+  private:
+  std::vector<std::string> _datagrams;
+  std::atomic<size_t> _count;
+  bench::LoopbackReceiver _socket;
+};
+
+#if defined(OSC_USE_SENDMMSG)
+static std::atomic<size_t> gSendCalls(0);
+
+// Takes the place of the libc wrapper for the transport, so the bench can
+// see how many calls a burst took.
+extern "C" int sendmmsg(int fd, mmsghdr* headers, unsigned int count, int flags) {
+  gSendCalls.fetch_add(1, std::memory_order_relaxed);
+  return (int) syscall(SYS_sendmmsg, fd, headers, count, flags);
+}
+#endif
+
+static OSCSample makeSample(size_t index) {
+  OSCSample sample;
+  sample.time = ((uint64_t) 3900000000u << 32) + index;
+  sample.channels[0] = 1;
+  sample.channels[1] = 1;
+  sample.values[0] = (float) index;
+  sample.values[1] = -0.5f * index;
+  return sample;
+}
+
+// Encoded independently of the sender's cached template.
+static std::string expectedPacket(size_t index) {
+  const OSCSample sample = makeSample(index);
+  OSCBundle bundle;
+  bundle.time = sample.time;
+  bundle.messagesSize = 1;
+  OSCMessage& msg = bundle.messages[0];
+  msg.setAddress(kAddress);
+  msg.valuesSize = 2;
+  for (size_t i = 0; i < 2; i++) {
+    msg.values[i].type = OSCMessageValue::FLOAT;
+    msg.values[i].f = sample.values[i];
+  }
+
+  char buffer[kMaxPacketSize];
+  const size_t size = makePacket(buffer, sizeof(buffer), bundle);
+  return std::string(buffer, size);
+}
+
+static bool waitFor(const std::vector<DatagramReceiver*>& receivers, size_t count) {
+  const std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + kTimeout;
+  for (DatagramReceiver* receiver : receivers) {
+    while (receiver->count() < count) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  return true;
+}
+
+int main() {
+  DatagramReceiver first;
+  DatagramReceiver second;
+  const std::vector<DatagramReceiver*> receivers = {&first, &second};
+
+  OSCDestinations destinations;
+  for (DatagramReceiver* receiver : receivers) {
+    destinations.endpoints.push_back(
+      udp::endpoint(boost::asio::ip::address_v4::loopback(), receiver->port())
+    );
+  }
+
+  OSCSender sender;
+  sender.setAddress(kAddress);
+  sender.setDestinations(destinations);
+  sender.start();
+
+  // Each burst lands in the ring faster than a drain tick, so the I/O
+  // thread sends it as one batch. Waiting for delivery in between keeps
+  // the receivers' socket buffers from overflowing.
+  const size_t total = kBursts * kBurstSize;
+  bool isComplete = true;
+  size_t maxSendCalls = 0;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t burst = 0; burst < kBursts && isComplete; burst++) {
+#if defined(OSC_USE_SENDMMSG)
+    const size_t sendCalls = gSendCalls.load(std::memory_order_relaxed);
+#endif
+    for (size_t i = 0; i < kBurstSize; i++) {
+      sender.push(makeSample(burst * kBurstSize + i));
+    }
+    isComplete = waitFor(receivers, (burst + 1) * kBurstSize);
+#if defined(OSC_USE_SENDMMSG)
+    // Delivered, so every call for the burst returned. Idle drain ticks
+    // make none.
+    maxSendCalls = std::max(maxSendCalls, gSendCalls.load(std::memory_order_relaxed) - sendCalls);
+#endif
+  }
+  const double elapsed = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - start
+  ).count();
+
+  const OSCSenderCounters counters = sender.counters();
+  sender.stop();
+
+  int failures = 0;
+  if (!isComplete) {
+    printf("timed out waiting for datagrams\n");
+    failures++;
+  }
+  if (counters.dropped != 0 || counters.sendErrors != 0) {
+    printf(
+      "%llu dropped, %llu send errors\n",
+      (unsigned long long) counters.dropped,
+      (unsigned long long) counters.sendErrors
+    );
+    failures++;
+  }
+
+#if defined(OSC_USE_SENDMMSG)
+  printf("at most %zu sendmmsg() calls per burst\n", maxSendCalls);
+  if (maxSendCalls > kMaxSendCallsPerBurst) {
+    printf("bursts were not batched\n");
+    failures++;
+  }
+#endif
+
+  for (size_t r = 0; r < receivers.size(); r++) {
+    const size_t count = receivers[r]->count();
+    if (count != total) {
+      printf("receiver %zu got %zu of %zu datagrams\n", r, count, total);
+      failures++;
+    }
+    const std::vector<std::string>& datagrams = receivers[r]->datagrams();
+    for (size_t i = 0; i < count && i < total; i++) {
+      if (datagrams[i] != expectedPacket(i)) {
+        printf("receiver %zu: datagram %zu is wrong or out of order\n", r, i);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  bench::Result result;
+  result.iterations = total * receivers.size();
+  result.nsPerOp = elapsed / result.iterations;
+  char name[64];
+  snprintf(name, sizeof(name), "batched send, %zu per burst, 2 dests", kBurstSize);
+  bench::report(name, result);
+
+  return failures == 0 ? 0 : 1;
+}
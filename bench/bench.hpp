@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Minimal timing loop shared by the benchmarks. Runs fn() in batches until
+// at least kMinDuration has passed and reports the mean cost per call.
+namespace bench {
+
+const std::chrono::milliseconds kMinDuration(200);
+
+// Keeps the optimizer from discarding results.
+template <typename T>
+inline void doNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result {
+  uint64_t iterations;
+  double nsPerOp;
+};
+
+template <typename Fn>
+Result measure(Fn fn, uint64_t batch = 1024) {
+  using clock = std::chrono::steady_clock;
+
+  for (uint64_t i = 0; i < batch; i++) fn();
+
+  uint64_t iterations = 0;
+  clock::time_point start = clock::now();
+  clock::duration elapsed;
+  do {
+    for (uint64_t i = 0; i < batch; i++) fn();
+    iterations += batch;
+    elapsed = clock::now() - start;
+  } while (elapsed < kMinDuration);
+
+  Result result;
+  result.iterations = iterations;
+  result.nsPerOp =
+    std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  return result;
+}
+
+inline void report(const char* name, const Result& result) {
+  printf(
+    "%-40s %10.1f ns/op %14.0f ops/s\n",
+    name,
+    result.nsPerOp,
+    1e9 / result.nsPerOp
+  );
+}
+
+// For operations that handle several OSC messages at once, e.g. a whole
+// bundle, reports the cost per message instead of per call.
+inline void reportMessages(const char* name, const Result& result, size_t messages) {
+  const double nsPerMessage = result.nsPerOp / messages;
+  printf(
+    "%-40s %10.1f ns/msg %13.0f msgs/s\n",
+    name,
+    nsPerMessage,
+    1e9 / nsPerMessage
+  );
+}
+
+// A UDP socket on 127.0.0.1 with a port picked by the kernel, read on a
+// thread of its own between start() and stop(). The socket buffer is
+// large enough for a burst from every sender in a run. Owners keep it as
+// their last member, so the thread is gone before their state is.
+class LoopbackReceiver {
+  public:
+  typedef std::function<void (const char* data, size_t size)> Handler;
+
+  LoopbackReceiver(): _is_running(false) {
+    _socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    const int bufferSize = 4 * 1024 * 1024;
+    setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    // Short, so stop() does not wait for long.
+    timeval timeout = {0, 50000};
+    setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(_socket, (sockaddr*) &address, sizeof(address));
+
+    socklen_t length = sizeof(address);
+    getsockname(_socket, (sockaddr*) &address, &length);
+    _port = ntohs(address.sin_port);
+  }
+
+  LoopbackReceiver(const LoopbackReceiver&) = delete;
+  LoopbackReceiver& operator=(const LoopbackReceiver&) = delete;
+
+  ~LoopbackReceiver() {
+    stop();
+    close(_socket);
+  }
+
+  uint16_t port() const {
+    return _port;
+  }
+
+  // onDatagram runs on the receiver thread for every datagram.
+  void start(Handler onDatagram) {
+    _is_running.store(true, std::memory_order_relaxed);
+    _thread = std::thread([this, onDatagram] () {
+      char buffer[64 * 1024];
+      while (_is_running.load(std::memory_order_relaxed)) {
+        ssize_t size = recv(_socket, buffer, sizeof(buffer), 0);
+        if (size > 0) onDatagram(buffer, (size_t) size);
+      }
+    });
+  }
+
+  void stop() {
+    _is_running.store(false, std::memory_order_relaxed);
+    if (_thread.joinable()) _thread.join();
+  }
+
+  private:
+  int _socket;
+  uint16_t _port;
+  std::atomic<bool> _is_running;
+  std::thread _thread;
+};
+
+}
@@ -0,0 +1,175 @@
+// Encode and decode throughput for the packet shapes the plugin sends:
+// makePacket() and the cached template, raw Client::Packet for nested
+// bundles, and a Server::Packet / ArgStream walk over each result.
+#include "bench.hpp"
+#include <OSCSender.cpp>
+#include <oscpp/server.hpp>
+#include <cstring>
+#include <vector>
+
+const size_t kBufferSize = 4096;
+const size_t kNestedBundles = 4;
+const size_t kNestedMessages = 4;
+
+static char gStrings[4][32] = {"kick", "snare_rimshot", "hihat_open_long", "crash"};
+
+// Visits every argument the way OSCReceiver does, descending into arrays.
+static void walkArgs(OSCPP::Server::ArgStream args, float& sum) {
+  while (!args.atEnd()) {
+    switch (args.tag()) {
+      case 'f':
+        sum += args.float32();
+        break;
+      case 'i':
+        sum += (float) args.int32();
+        break;
+      case 's':
+        sum += (float) args.string()[0];
+        break;
+      case '[':
+        walkArgs(args.array(), sum);
+        break;
+      default:
+        args.drop();
+    }
+  }
+}
+
+// Returns the number of messages in the packet.
+static size_t walkPacket(const OSCPP::Server::Packet& packet, float& sum) {
+  if (packet.isBundle()) {
+    size_t messages = 0;
+    OSCPP::Server::PacketStream packets(OSCPP::Server::Bundle(packet).packets());
+    while (!packets.atEnd()) messages += walkPacket(packets.next(), sum);
+    return messages;
+  }
+  OSCPP::Server::Message message(packet);
+  sum += (float) message.address()[1];
+  walkArgs(message.args(), sum);
+  return 1;
+}
+
+static void runDecode(const char* name, const char* packet, size_t size, size_t messages) {
+  float sum = 0.f;
+  if (walkPacket(OSCPP::Server::Packet(packet, size), sum) != messages) {
+    printf("%s decoded the wrong number of messages\n", name);
+  }
+  bench::Result result = bench::measure([&] () {
+    walkPacket(OSCPP::Server::Packet(packet, size), sum);
+  });
+  bench::doNotOptimize(sum);
+  bench::reportMessages(name, result, messages);
+}
+
+static void addFloats(OSCMessage& msg, size_t n, bool array) {
+  msg.valuesSize = 0;
+  if (array) msg.values[msg.valuesSize++].type = OSCMessageValue::ARRAY_BEGIN;
+  for (size_t i = 0; i < n; i++) {
+    OSCMessageValue& val = msg.values[msg.valuesSize++];
+    val.type = OSCMessageValue::FLOAT;
+    val.f = 0.01f * i;
+  }
+  if (array) msg.values[msg.valuesSize++].type = OSCMessageValue::ARRAY_END;
+}
+
+// The two shapes CVtoOSC sends, through makePacket() and the template.
+// Returns false if the two encode different bytes.
+static bool runFloats(const char* name, size_t n, bool array) {
+  OSCBundle bundle;
+  bundle.time = formatTime(getCurrentTime());
+  bundle.messagesSize = 1;
+  bundle.messages[0].setAddress("/rack/cv1");
+  addFloats(bundle.messages[0], n, array);
+
+  std::vector<char> buffer(kBufferSize);
+  size_t size = 0;
+  bench::Result generic = bench::measure([&] () {
+    size = makePacket(buffer.data(), buffer.size(), bundle);
+    bench::doNotOptimize(buffer[0]);
+  });
+
+  OSCMessageTemplate messageTemplate;
+  messageTemplate.build(bundle);
+  std::vector<float> values(messageTemplate.slotsSize());
+  for (size_t i = 0; i < values.size(); i++) values[i] = 0.01f * i;
+  std::vector<char> rendered(kMaxTemplateSize);
+  bench::Result cached = bench::measure([&] () {
+    messageTemplate.render(rendered.data(), bundle.time, values.data());
+    bench::doNotOptimize(rendered[0]);
+  });
+
+  char label[64];
+  snprintf(label, sizeof(label), "makePacket, %s", name);
+  bench::reportMessages(label, generic, 1);
+  snprintf(label, sizeof(label), "template render, %s", name);
+  bench::reportMessages(label, cached, 1);
+  snprintf(label, sizeof(label), "decode, %s", name);
+  runDecode(label, buffer.data(), size, 1);
+
+  const bool isEqual = std::memcmp(buffer.data(), rendered.data(), size) == 0;
+  if (!isEqual) {
+    printf("makePacket and the template differ for %s\n", name);
+  }
+  return isEqual;
+}
+
+// A bundle of bundles, written directly with Client::Packet since
+// makePacket() only produces flat bundles.
+static void runNested() {
+  const uint64_t time = formatTime(getCurrentTime());
+  std::vector<char> buffer(kBufferSize);
+  size_t size = 0;
+  bench::Result result = bench::measure([&] () {
+    OSCPP::Client::Packet packet(buffer.data(), buffer.size());
+    packet.openBundle(time);
+    for (size_t i = 0; i < kNestedBundles; i++) {
+      packet.openBundle(time);
+      for (size_t j = 0; j < kNestedMessages; j++) {
+        packet.openMessage("/rack/cv", 2).float32(0.25f).float32(0.75f).closeMessage();
+      }
+      packet.closeBundle();
+    }
+    packet.closeBundle();
+    size = packet.size();
+    bench::doNotOptimize(buffer[0]);
+  });
+
+  const size_t messages = kNestedBundles * kNestedMessages;
+  bench::reportMessages("Client::Packet, nested bundles", result, messages);
+  runDecode("decode, nested bundles", buffer.data(), size, messages);
+}
+
+static void runStrings() {
+  OSCBundle bundle;
+  bundle.time = formatTime(getCurrentTime());
+  bundle.messagesSize = kMaxBundleMessages;
+  for (size_t i = 0; i < kMaxBundleMessages; i++) {
+    OSCMessage& msg = bundle.messages[i];
+    msg.setAddress("/drum_machine/pattern/step/trigger");
+    msg.valuesSize = 5;
+    msg.values[0].type = OSCMessageValue::INT;
+    msg.values[0].i = (int) i;
+    for (size_t j = 1; j < msg.valuesSize; j++) {
+      msg.values[j].type = OSCMessageValue::STRING;
+      msg.values[j].s = gStrings[(i + j) % 4];
+    }
+  }
+
+  std::vector<char> buffer(kBufferSize);
+  size_t size = 0;
+  bench::Result result = bench::measure([&] () {
+    size = makePacket(buffer.data(), buffer.size(), bundle);
+    bench::doNotOptimize(buffer[0]);
+  });
+
+  bench::reportMessages("makePacket, strings", result, kMaxBundleMessages);
+  runDecode("decode, strings", buffer.data(), size, kMaxBundleMessages);
+}
+
+int main() {
+  bool isEqual = runFloats("2 floats", 2, false);
+  isEqual = runFloats("16-float array", kMaxChannels, true) && isEqual;
+  runNested();
+  runStrings();
+  return isEqual ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// Destination URLs as CVtoOSC parses them, then a round trip through
+// OSCSender to a UDP receiver on [::1]. Fails on any unexpected result,
+// the round trip is skipped on hosts without IPv6.
+#include "bench.hpp"
+#include <OSCUrl.cpp>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct UrlCase {
+  const char* url;
+  bool isValid;
+  size_t endpoints;
+  size_t localEndpoints;
+};
+
+const UrlCase kUrlCases[] = {
+  {"127.0.0.1:7000", true, 1, 0},
+  {"[::1]:7000", true, 1, 0},
+  {"[ff02::1]:9000", true, 1, 0},
+  {"[fe80::1%1]:9000", true, 1, 0},
+  {"unix:/tmp/osc.sock", true, 0, 1},
+  {" 127.0.0.1:7000 , [::1]:7001,unix:/tmp/osc.sock", true, 2, 1},
+  {"::1:7000", false, 0, 0},
+  {"[::1]", false, 0, 0},
+  {"[::1]:", false, 0, 0},
+  {"[::1]:70000", false, 0, 0},
+  {"[not-an-address]:7000", false, 0, 0},
+  {"unix:", false, 0, 0},
+  {"127.0.0.1:7000,", false, 0, 0},
+  {"", false, 0, 0},
+};
+
+const std::chrono::seconds kTimeout(5);
+
+static int gFailures = 0;
+
+static void check(bool isOk, const std::string& what) {
+  printf("%-48s %s\n", what.c_str(), isOk ? "ok" : "FAILED");
+  if (!isOk) gFailures++;
+}
+
+static void checkUrls() {
+  for (const UrlCase& urlCase : kUrlCases) {
+    OSCDestinations destinations;
+    const bool isValid = parseDestinations(urlCase.url, destinations);
+    bool isOk = isValid == urlCase.isValid;
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    if (isOk && isValid) {
+      isOk =
+        destinations.endpoints.size() == urlCase.endpoints &&
+        destinations.localEndpoints.size() == urlCase.localEndpoints;
+    }
+#else
+    // Without local sockets every unix: entry is rejected.
+    if (urlCase.localEndpoints > 0) isOk = !isValid;
+#endif
+    check(isOk, std::string("parse '") + urlCase.url + "'");
+  }
+
+  // Brackets are taken off and the port kept.
+  OSCDestinations destinations;
+  const bool isParsed = parseDestinations("[::1]:7000", destinations);
+  check(
+    isParsed &&
+    destinations.endpoints[0].address() == boost::asio::ip::address_v6::loopback() &&
+    destinations.endpoints[0].port() == 7000,
+    "parse '[::1]:7000' to loopback port 7000"
+  );
+
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+  destinations = OSCDestinations();
+  parseDestinations("unix:/tmp/osc.sock", destinations);
+  check(
+    destinations.localEndpoints.size() == 1 &&
+    destinations.localEndpoints[0].path() == "/tmp/osc.sock",
+    "parse 'unix:/tmp/osc.sock' to its path"
+  );
+#endif
+}
+
+static void checkIpv6RoundTrip() {
+  const int receiver = socket(AF_INET6, SOCK_DGRAM, 0);
+  sockaddr_in6 address = {};
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_loopback;
+  address.sin6_port = 0;
+  if (receiver < 0 || bind(receiver, (sockaddr*) &address, sizeof(address)) != 0) {
+    printf("%-48s skipped, no IPv6 loopback\n", "IPv6 round trip");
+    if (receiver >= 0) close(receiver);
+    return;
+  }
+  socklen_t length = sizeof(address);
+  getsockname(receiver, (sockaddr*) &address, &length);
+  timeval timeout = {(time_t) kTimeout.count(), 0};
+  setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  OSCDestinations destinations;
+  const std::string url = "[::1]:" + std::to_string(ntohs(address.sin6_port));
+  check(parseDestinations(url, destinations), "parse " + url);
+
+  OSCSender sender;
+  sender.setAddress("/v6");
+  sender.setDestinations(destinations);
+  sender.start();
+
+  OSCSample sample;
+  sample.time = (uint64_t) 3900000000u << 32;
+  sample.channels[0] = 1;
+  sample.channels[1] = 1;
+  sample.values[0] = 0.25f;
+  sample.values[1] = 0.75f;
+  sender.push(sample);
+
+  OSCBundle bundle;
+  bundle.time = sample.time;
+  bundle.messagesSize = 1;
+  bundle.messages[0].setAddress("/v6");
+  bundle.messages[0].valuesSize = 2;
+  for (size_t i = 0; i < 2; i++) {
+    bundle.messages[0].values[i].type = OSCMessageValue::FLOAT;
+    bundle.messages[0].values[i].f = sample.values[i];
+  }
+  char expected[kMaxPacketSize];
+  const size_t expectedSize = makePacket(expected, sizeof(expected), bundle);
+
+  char received[kMaxPacketSize];
+  const ssize_t size = recv(receiver, received, sizeof(received), 0);
+  check(
+    size == (ssize_t) expectedSize && std::memcmp(received, expected, expectedSize) == 0,
+    "IPv6 round trip over [::1]"
+  );
+
+  sender.stop();
+  close(receiver);
+}
+
+int main() {
+  checkUrls();
+  checkIpv6RoundTrip();
+  return gFailures == 0 ? 0 : 1;
+}
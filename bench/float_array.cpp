@@ -0,0 +1,47 @@
+// Scalar putFloat32() loop vs. the bulk putFloat32Array() writer.
+#include "bench.hpp"
+#include <oscpp/detail/stream.hpp>
+#include <cstring>
+#include <vector>
+
+// Returns false if the bulk writer's bytes differ.
+static bool runSize(size_t n) {
+  std::vector<float> values(n);
+  for (size_t i = 0; i < n; i++) values[i] = 0.001f * i;
+  std::vector<char> buffer(4 * n);
+
+  bench::Result scalar = bench::measure([&] () {
+    OSCPP::WriteStream stream(buffer.data(), buffer.size());
+    for (size_t i = 0; i < n; i++) stream.putFloat32(values[i]);
+    bench::doNotOptimize(buffer[0]);
+  });
+
+  bench::Result bulk = bench::measure([&] () {
+    OSCPP::WriteStream stream(buffer.data(), buffer.size());
+    stream.putFloat32Array(values.data(), n);
+    bench::doNotOptimize(buffer[0]);
+  });
+
+  // Both paths have to produce identical bytes.
+  std::vector<char> expected(4 * n);
+  OSCPP::WriteStream expectedStream(expected.data(), expected.size());
+  for (size_t i = 0; i < n; i++) expectedStream.putFloat32(values[i]);
+  const bool isEqual = std::memcmp(expected.data(), buffer.data(), 4 * n) == 0;
+  if (!isEqual) {
+    printf("putFloat32Array output differs for n=%zu\n", n);
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "putFloat32 x%zu", n);
+  bench::report(name, scalar);
+  snprintf(name, sizeof(name), "putFloat32Array(%zu)", n);
+  bench::report(name, bulk);
+  return isEqual;
+}
+
+int main() {
+  const size_t sizes[] = {2, 4, 16, 32, 64, 256, 1024};
+  bool isEqual = true;
+  for (size_t n : sizes) isEqual = runSize(n) && isEqual;
+  return isEqual ? 0 : 1;
+}
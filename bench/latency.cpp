@@ -0,0 +1,229 @@
+// End-to-end latency over loopback, from OSCSampler seeing a trigger to
+// the datagram arriving at a receiver. An engine thread runs OSCSampler
+// and OSCSender pairs the way CVtoOSC does, paced in blocks like an audio
+// callback. A plain UDP socket receives and parses with OSCPP::Server,
+// latency is receive time minus the timetag. Both come from
+// gettimeofday(), so the resolution is a microsecond.
+//
+//   build/latency [rate Hz per module] [modules] [seconds]
+//
+// Without arguments a short sweep runs.
+#include "bench.hpp"
+#include <OSCSampler.cpp>
+#include <OSCSender.cpp>
+#include <oscpp/server.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+const float kEngineSampleRate = 48000.f;
+const int kEngineBlockSize = 64;
+// Time given to the I/O thread to deliver what is still queued.
+const std::chrono::milliseconds kSettleTime(200);
+
+struct Config {
+  int rate;
+  int modules;
+  int seconds;
+};
+
+class LatencyReceiver {
+  public:
+  explicit LatencyReceiver(int modules): _received(modules, 0), _errors(0) {
+  }
+
+  uint16_t port() const {
+    return _socket.port();
+  }
+
+  void start(size_t expected) {
+    _latencies.reserve(expected);
+    _socket.start([this] (const char* data, size_t size) { receive(data, size); });
+  }
+
+  void stop() {
+    _socket.stop();
+  }
+
+  // Signed. The timebase is anchored while a block is processed, so the
+  // frames of a block carry timetags up to a block later than the time
+  // they were processed at, and a fast delivery can beat its timetag.
+  std::vector<int64_t>& latencies() {
+    return _latencies;
+  }
+
+  uint64_t received() const {
+    uint64_t total = 0;
+    for (uint64_t count : _received) total += count;
+    return total;
+  }
+
+  uint64_t errors() const {
+    return _errors;
+  }
+
+  private:
+  void receive(const char* data, size_t size) {
+    const uint64_t now = formatTime(getCurrentTime());
+
+    try {
+      OSCPP::Server::Packet packet(data, size);
+      if (!packet.isBundle()) {
+        _errors++;
+        return;
+      }
+      OSCPP::Server::Bundle bundle(packet);
+      OSCPP::Server::PacketStream packets(bundle.packets());
+      OSCPP::Server::Message message(packets.next());
+      OSCPP::Server::ArgStream args(message.args());
+      args.float32();
+      const size_t module = (size_t) args.float32();
+      if (module >= _received.size()) {
+        _errors++;
+        return;
+      }
+      _received[module]++;
+
+      // NTP fractions to nanoseconds.
+      const int64_t delta = (int64_t) (now - bundle.time());
+      _latencies.push_back((int64_t) ((double) delta * 1e9 / 4294967296.0));
+    }
+    catch (const OSCPP::Error& e) {
+      _errors++;
+    }
+  }
+
+  std::vector<uint64_t> _received;
+  std::vector<int64_t> _latencies;
+  uint64_t _errors;
+  bench::LoopbackReceiver _socket;
+};
+
+static double percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) return 0.;
+  size_t index = (size_t) (p / 100. * (sorted.size() - 1) + 0.5);
+  return sorted[index] / 1000.;
+}
+
+static void run(const Config& config) {
+  // Trigger pulses one frame long, so at most every other frame.
+  const int interval = std::max((int) (kEngineSampleRate / config.rate), 2);
+  const int64_t frames = (int64_t) kEngineSampleRate * config.seconds;
+  const size_t expected = (size_t) (frames / interval + 1) * config.modules;
+
+  LatencyReceiver receiver(config.modules);
+  receiver.start(expected);
+
+  OSCDestinations destinations;
+  destinations.endpoints.push_back(
+    udp::endpoint(boost::asio::ip::address_v4::loopback(), receiver.port())
+  );
+
+  std::vector<std::unique_ptr<OSCSender>> senders;
+  std::vector<OSCSampler> samplers(config.modules);
+  for (int m = 0; m < config.modules; m++) {
+    senders.emplace_back(new OSCSender());
+    senders.back()->setAddress("/latency");
+    senders.back()->setDestinations(destinations);
+    senders.back()->start();
+  }
+
+  // The inputs sit at 0V. Once the sampler fires, its values are replaced
+  // by a sequence number and the module index for the receiver.
+  const float voltages[2] = {0.f, 0.f};
+  OSCSamplerFrame frame;
+  frame.isTriggerConnected = true;
+  frame.period = 0.f;
+  frame.sampleTime = 1.f / kEngineSampleRate;
+  frame.sampleRate = kEngineSampleRate;
+  frame.channels[0] = 1;
+  frame.channels[1] = 1;
+  frame.voltages[0] = &voltages[0];
+  frame.voltages[1] = &voltages[1];
+
+  uint64_t pushed = 0;
+  OSCSample sample;
+
+  using clock = std::chrono::steady_clock;
+  const clock::time_point start = clock::now();
+  for (int64_t blockStart = 0; blockStart < frames; blockStart += kEngineBlockSize) {
+    // Like an audio callback, a block is processed once all of its frames
+    // have been captured.
+    std::this_thread::sleep_until(
+      start + std::chrono::nanoseconds(
+        (int64_t) ((blockStart + kEngineBlockSize) * 1e9 / kEngineSampleRate)
+      )
+    );
+
+    for (int64_t f = blockStart; f < blockStart + kEngineBlockSize && f < frames; f++) {
+      frame.frame = f;
+      frame.trigger = f % interval == 0 ? 10.f : 0.f;
+      for (int m = 0; m < config.modules; m++) {
+        if (!samplers[m].process(frame, sample)) continue;
+
+        sample.values[0] = (float) (f / interval);
+        sample.values[1] = (float) m;
+        pushed++;
+        senders[m]->push(sample);
+      }
+    }
+  }
+
+  std::this_thread::sleep_for(kSettleTime);
+  uint64_t dropped = 0;
+  for (std::unique_ptr<OSCSender>& sender : senders) {
+    dropped += sender->dropped();
+    sender->stop();
+  }
+  receiver.stop();
+
+  std::vector<int64_t>& latencies = receiver.latencies();
+  std::sort(latencies.begin(), latencies.end());
+  const uint64_t received = receiver.received();
+  const double loss =
+    pushed > 0 ? 100. * (double) (pushed - std::min(received, pushed)) / pushed : 0.;
+
+  printf(
+    "%6d Hz x %3d modules, %d s: p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  "
+    "max %8.1f us  loss %.3f%% (%llu sent, %llu received, %llu dropped, %llu errors)\n",
+    (int) (kEngineSampleRate / interval),
+    config.modules,
+    config.seconds,
+    percentile(latencies, 50.),
+    percentile(latencies, 99.),
+    percentile(latencies, 99.9),
+    latencies.empty() ? 0. : latencies.back() / 1000.,
+    loss,
+    (unsigned long long) pushed,
+    (unsigned long long) received,
+    (unsigned long long) dropped,
+    (unsigned long long) receiver.errors()
+  );
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    Config config;
+    config.rate = std::atoi(argv[1]);
+    config.modules = argc > 2 ? std::atoi(argv[2]) : 1;
+    config.seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+    if (config.rate <= 0 || config.modules <= 0 || config.seconds <= 0) {
+      fprintf(stderr, "usage: %s [rate Hz per module] [modules] [seconds]\n", argv[0]);
+      return 1;
+    }
+    run(config);
+    return 0;
+  }
+
+  const Config sweep[] = {
+    {100, 1, 1},
+    {1000, 1, 1},
+    {1000, 16, 1},
+    {12000, 16, 1},
+  };
+  for (const Config& config : sweep) run(config);
+  return 0;
+}
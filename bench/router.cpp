@@ -0,0 +1,118 @@
+// OSCRouter matching of routes and incoming patterns, and how
+// OSCReceiver splits its address list. Fails on any unexpected result,
+// then times dispatch as the number of routes grows.
+#include "bench.hpp"
+#include <OSCReceiver.cpp>
+#include <OSCRouter.cpp>
+#include <string>
+#include <vector>
+
+struct MatchCase {
+  const char* route;
+  const char* address;
+  bool isMatch;
+};
+
+const MatchCase kMatchCases[] = {
+  {"/mixer/*/fader", "/mixer/ch1/fader", true},
+  {"/mixer/*/fader", "/mixer/ch1/mute", false},
+  {"/mixer/*", "/mixer/ch1/fader", false},
+  {"/mixer/ch?", "/mixer/ch7", true},
+  {"/mixer/ch?", "/mixer/ch10", false},
+  {"/mixer/ch[!a-z]", "/mixer/ch7", true},
+  {"/mixer/ch[!a-z]", "/mixer/chx", false},
+  {"/mixer/ch[0-9]", "/mixer/ch5", true},
+  {"/synth/{osc,lfo}/rate", "/synth/lfo/rate", true},
+  {"/synth/{osc,lfo}/rate", "/synth/env/rate", false},
+  // Incoming patterns against literal routes.
+  {"/mixer/ch1/fader", "/mixer/*/fader", true},
+  {"/mixer/ch1/fader", "/mixer/ch?/fader", true},
+  {"/mixer/ch1/fader", "/mixer/ch[!0-9]/fader", false},
+  {"/synth/lfo/rate", "/synth/{osc,lfo}/rate", true},
+  {"/synth/env/rate", "/synth/{osc,lfo}/rate", false},
+};
+
+struct AddressListCase {
+  const char* list;
+  bool isValid;
+};
+
+const AddressListCase kAddressListCases[] = {
+  {"/cv", true},
+  {"/cv, /mixer/*/fader", true},
+  {"/a/{b,c}", true},
+  {"/a/{b,c}, /d/{e,f}/g", true},
+  {"/a/{b,c", false},
+  {"/a/b}", false},
+  {"/cv, mixer", false},
+};
+
+static int gFailures = 0;
+
+static void check(bool isOk, const std::string& what) {
+  printf("%-48s %s\n", what.c_str(), isOk ? "ok" : "FAILED");
+  if (!isOk) gFailures++;
+}
+
+static void checkMatches() {
+  for (const MatchCase& matchCase : kMatchCases) {
+    OSCRouter router;
+    router.add(matchCase.route, 1);
+    size_t matched = 0;
+    router.dispatch(matchCase.address, [&] (size_t id) { matched += id; });
+    check(
+      (matched == 1) == matchCase.isMatch,
+      std::string(matchCase.route) + (matchCase.isMatch ? " matches " : " rejects ") +
+        matchCase.address
+    );
+  }
+}
+
+static void checkAddressLists() {
+  OSCReceiver receiver;
+  for (const AddressListCase& listCase : kAddressListCases) {
+    check(
+      receiver.setAddress(listCase.list) == listCase.isValid,
+      std::string("address list '") + listCase.list + "'"
+    );
+  }
+}
+
+static void runSize(size_t n) {
+  OSCRouter router;
+  std::vector<std::string> addresses;
+  for (size_t i = 0; i < n; i++) {
+    addresses.push_back("/mixer/ch" + std::to_string(i) + "/fader");
+    router.add(addresses.back(), i);
+  }
+  router.add("/mixer/*/mute", n);
+  router.add("/mixer/ch[0-9]/solo", n + 1);
+
+  size_t next = 0;
+  size_t matched = 0;
+  bench::Result literal = bench::measure([&] () {
+    router.dispatch(addresses[next].c_str(), [&] (size_t id) { matched += id; });
+    next = next + 1 == n ? 0 : next + 1;
+  });
+
+  bench::Result pattern = bench::measure([&] () {
+    router.dispatch("/mixer/ch7/solo", [&] (size_t id) { matched += id; });
+  });
+  bench::doNotOptimize(matched);
+
+  char name[64];
+  snprintf(name, sizeof(name), "dispatch literal, %zu routes", n);
+  bench::report(name, literal);
+  snprintf(name, sizeof(name), "dispatch via pattern, %zu routes", n);
+  bench::report(name, pattern);
+}
+
+int main() {
+  checkMatches();
+  checkAddressLists();
+  if (gFailures > 0) return 1;
+
+  const size_t sizes[] = {1, 10, 100, 500};
+  for (size_t n : sizes) runSize(n);
+  return 0;
+}
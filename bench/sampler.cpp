@@ -0,0 +1,160 @@
+// Per-sample cost of OSCSampler, the CVtoOSC process() logic, fed with
+// synthetic voltages at the common engine rates. Also checks that dead
+// bands apply per input.
+#include "bench.hpp"
+#include <OSCSampler.cpp>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Voltages are precomputed for a block of frames and replayed, so the
+// loop measures the sampler rather than the signal generator.
+const size_t kBlockFrames = 4096;
+const int kSeconds = 2;
+
+struct Scenario {
+  const char* name;
+  int channels;
+  // Indices into kDeadBands, per input.
+  int deadBands[kMaxInputs];
+  // 0 is free-running, otherwise a trigger every this many frames.
+  int triggerInterval;
+};
+
+static uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static void run(const Scenario& scenario, float sampleRate) {
+  // A slow sine per channel, so the dead band lets some sends through.
+  std::vector<float> voltages(kBlockFrames * kMaxInputs * kMaxChannels);
+  for (size_t f = 0; f < kBlockFrames; f++) {
+    for (size_t c = 0; c < kMaxInputs * kMaxChannels; c++) {
+      voltages[(f * kMaxInputs * kMaxChannels) + c] =
+        5.f * std::sin(2.f * (float) M_PI * (1.f + c) * f / sampleRate);
+    }
+  }
+
+  OSCSampler sampler;
+  sampler.deadBand[0] = scenario.deadBands[0];
+  sampler.deadBand[1] = scenario.deadBands[1];
+
+  OSCSamplerFrame frame;
+  frame.isTriggerConnected = scenario.triggerInterval > 0;
+  frame.period = 0.01f;
+  frame.sampleTime = 1.f / sampleRate;
+  frame.sampleRate = sampleRate;
+  frame.channels[0] = scenario.channels;
+  frame.channels[1] = scenario.channels;
+
+  const int64_t frames = (int64_t) sampleRate * kSeconds;
+  OSCSample sample;
+  uint64_t sent = 0;
+
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now();
+  const uint64_t startCycles = readCycles();
+  for (int64_t f = 0; f < frames; f++) {
+    const float* block = &voltages[(f % kBlockFrames) * kMaxInputs * kMaxChannels];
+    frame.voltages[0] = block;
+    frame.voltages[1] = block + kMaxChannels;
+    frame.trigger =
+      frame.isTriggerConnected && f % scenario.triggerInterval == 0 ? 10.f : 0.f;
+    frame.frame = f;
+    if (sampler.process(frame, sample)) {
+      bench::doNotOptimize(sample.values[0]);
+      sent++;
+    }
+  }
+  const uint64_t cycles = readCycles() - startCycles;
+  const double ns =
+    std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+  // Share of the per-sample time budget at this rate.
+  const double nsPerSample = ns / frames;
+  const double budget = 100. * nsPerSample * sampleRate / 1e9;
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s @ %.0fk", scenario.name, sampleRate / 1000.f);
+  printf(
+    "%-40s %8.1f cycles/sample %7.2f ns/sample %8.4f%% budget %6llu sends\n",
+    name,
+    (double) cycles / frames,
+    nsPerSample,
+    budget,
+    (unsigned long long) sent
+  );
+}
+
+// CV1 without a dead band, CV2 with 10 mV. Returns false if a change on
+// either input is judged by the wrong band.
+static bool checkMixedDeadBands() {
+  OSCSampler sampler;
+  sampler.deadBand[1] = 3;
+
+  float voltages[kMaxInputs] = {1.f, 2.f};
+  OSCSamplerFrame frame;
+  frame.isTriggerConnected = false;
+  frame.trigger = 0.f;
+  frame.period = 0.f;
+  frame.sampleTime = 1.f / 48000.f;
+  frame.sampleRate = 48000.f;
+  frame.frame = 0;
+  for (size_t i = 0; i < kMaxInputs; i++) {
+    frame.channels[i] = 1;
+    frame.voltages[i] = &voltages[i];
+  }
+
+  OSCSample sample;
+  auto step = [&] () {
+    frame.frame++;
+    return sampler.process(frame, sample);
+  };
+
+  bool isOk = true;
+  if (!step()) {
+    printf("mixed dead bands: first frame not sent\n");
+    isOk = false;
+  }
+  if (step()) {
+    printf("mixed dead bands: sent without any change\n");
+    isOk = false;
+  }
+  voltages[1] += 0.005f;
+  if (step()) {
+    printf("mixed dead bands: CV2 sent within its dead band\n");
+    isOk = false;
+  }
+  voltages[0] += 0.001f;
+  if (!step()) {
+    printf("mixed dead bands: CV1 change missed\n");
+    isOk = false;
+  }
+  voltages[1] += 0.02f;
+  if (!step()) {
+    printf("mixed dead bands: CV2 change beyond its dead band missed\n");
+    isOk = false;
+  }
+  return isOk;
+}
+
+int main() {
+  const Scenario scenarios[] = {
+    {"free-running, 2x mono", 1, {0, 0}, 0},
+    {"free-running, 2x16, 5 mV dead band", 16, {2, 2}, 0},
+    {"free-running, 2x16, CV2 5 mV only", 16, {0, 2}, 0},
+    {"triggered /64, 2x16", 16, {0, 0}, 64},
+  };
+  const float rates[] = {48000.f, 96000.f, 192000.f};
+  for (const Scenario& scenario : scenarios) {
+    for (float rate : rates) run(scenario, rate);
+  }
+  return checkMixedDeadBands() ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+// OSCStreamConnection against a local TCP listener: SLIP escaping of END
+// and ESC, the int32 size prefix, the kMaxStreamBacklog cap, the reconnect
+// after the receiver went away, and the send counters along the way.
+// Fails on the first wrong byte or count.
+#include "bench.hpp"
+#include <OSCStreamConnection.cpp>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const std::chrono::seconds kTimeout(5);
+
+// Accepts one connection at a time and reads it with a timeout.
+class StreamListener {
+  public:
+  StreamListener() {
+    _socket = socket(AF_INET, SOCK_STREAM, 0);
+    const int reuse = 1;
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    setTimeout(_socket);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(_socket, (sockaddr*) &address, sizeof(address));
+    listen(_socket, 4);
+
+    socklen_t length = sizeof(address);
+    getsockname(_socket, (sockaddr*) &address, &length);
+    _port = ntohs(address.sin_port);
+  }
+
+  ~StreamListener() {
+    drop();
+    close(_socket);
+  }
+
+  uint16_t port() const {
+    return _port;
+  }
+
+  bool accept() {
+    drop();
+    _client = ::accept(_socket, nullptr, nullptr);
+    if (_client < 0) return false;
+    setTimeout(_client);
+    return true;
+  }
+
+  // Closes the accepted connection.
+  void drop() {
+    if (_client >= 0) close(_client);
+    _client = -1;
+  }
+
+  // Returns fewer bytes than asked for on timeout or end of stream.
+  std::string read(size_t size) {
+    std::string data(size, '\0');
+    size_t received = 0;
+    while (received < size) {
+      ssize_t n = recv(_client, &data[received], size - received, 0);
+      if (n <= 0) break;
+      received += (size_t) n;
+    }
+    data.resize(received);
+    return data;
+  }
+
+  private:
+  static void setTimeout(int socket) {
+    timeval timeout = {(time_t) kTimeout.count(), 0};
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  int _socket;
+  int _client = -1;
+  uint16_t _port;
+};
+
+// Runs the connection's io_context on a thread of its own, the way the
+// transport's I/O thread does.
+class StreamClient {
+  public:
+  StreamClient(uint16_t port, OSCStreamConnection::Framing framing):
+    _work_guard(_io.get_executor()),
+    _counters(std::make_shared<OSCSendCounters>()) {
+    _connection = std::make_shared<OSCStreamConnection>(
+      _io,
+      tcp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+      framing,
+      _counters
+    );
+    _thread = std::thread([this] () { _io.run(); });
+    run([this] () { _connection->open(); return true; });
+  }
+
+  ~StreamClient() {
+    run([this] () { _connection->close(); return true; });
+    _work_guard.reset();
+    _thread.join();
+  }
+
+  // Runs fn on the I/O thread and returns its result.
+  bool run(std::function<bool ()> fn) {
+    std::promise<bool> result;
+    boost::asio::post(_io, [&] () { result.set_value(fn()); });
+    return result.get_future().get();
+  }
+
+  bool send(const std::string& packet) {
+    return run([&] () {
+      const bool isQueued = _connection->enqueue(packet.data(), packet.size());
+      _connection->flush();
+      return isQueued;
+    });
+  }
+
+  bool waitConnected() {
+    const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + kTimeout;
+    while (!run([this] () { return _connection->isConnected(); })) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  OSCStreamConnection& connection() {
+    return *_connection;
+  }
+
+  // Waits for the write completions to catch up, the listener may have
+  // read the bytes before the client's handler ran.
+  bool waitCounted(uint64_t packets, uint64_t bytes) {
+    const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + kTimeout;
+    while (
+      _counters->packets.load() != packets ||
+      _counters->bytes.load() != bytes
+    ) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  uint64_t errors() const {
+    return _counters->errors.load();
+  }
+
+  private:
+  boost::asio::io_context _io;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _work_guard;
+  std::shared_ptr<OSCSendCounters> _counters;
+  std::shared_ptr<OSCStreamConnection> _connection;
+  std::thread _thread;
+};
+
+static int gFailures = 0;
+
+static void check(bool isOk, const char* what) {
+  printf("%-40s %s\n", what, isOk ? "ok" : "FAILED");
+  if (!isOk) gFailures++;
+}
+
+// END and ESC in the middle, so both escapes show up.
+static const std::string kSpecialPacket("\x01\xC0\x02\xDB\x03", 5);
+
+static void checkSlip() {
+  StreamListener listener;
+  StreamClient client(listener.port(), OSCStreamConnection::SLIP);
+  const bool isAccepted = listener.accept() && client.waitConnected();
+  check(isAccepted, "SLIP connect");
+  if (!isAccepted) return;
+
+  client.send(kSpecialPacket);
+  client.send(std::string("/a\0\0", 4));
+  const std::string expected(
+    "\xC0\x01\xDB\xDC\x02\xDB\xDD\x03\xC0"
+    "\xC0/a\0\0\xC0",
+    15
+  );
+  check(listener.read(expected.size()) == expected, "SLIP escaping of END and ESC");
+}
+
+static void checkSizePrefix() {
+  StreamListener listener;
+  StreamClient client(listener.port(), OSCStreamConnection::SIZE_PREFIX);
+  const bool isAccepted = listener.accept() && client.waitConnected();
+  check(isAccepted, "size prefix connect");
+  if (!isAccepted) return;
+
+  // Raw bytes, no escaping, and a size above 255 to see the byte order.
+  const std::string large(300, '\xC0');
+  client.send(kSpecialPacket);
+  client.send(large);
+  const std::string expected =
+    std::string("\0\0\0\x05", 4) + kSpecialPacket +
+    std::string("\0\0\x01\x2C", 4) + large;
+  check(listener.read(expected.size()) == expected, "int32 size prefix framing");
+  check(
+    client.waitCounted(2, kSpecialPacket.size() + large.size()),
+    "packets and bytes counted once written"
+  );
+}
+
+// Packets that are not flushed stay in the backlog, so exactly
+// kMaxStreamBacklog bytes of framed packets fit.
+static void checkBacklogCap() {
+  StreamListener listener;
+  StreamClient client(listener.port(), OSCStreamConnection::SIZE_PREFIX);
+  const bool isAccepted = listener.accept() && client.waitConnected();
+  check(isAccepted, "backlog connect");
+  if (!isAccepted) return;
+
+  const size_t framedSize = 1024;
+  const std::string packet(framedSize - 4, 'x');
+  size_t queued = 0;
+  const bool isRejected = !client.run([&] () {
+    while (queued <= kMaxStreamBacklog / framedSize) {
+      if (!client.connection().enqueue(packet.data(), packet.size())) return false;
+      queued++;
+    }
+    return true;
+  });
+  check(isRejected && queued == kMaxStreamBacklog / framedSize, "backlog capped at 64 KB");
+
+  std::string expected;
+  for (size_t i = 0; i < queued; i++) {
+    expected += std::string("\0\0\x03\xFC", 4) + packet;
+  }
+  client.run([&] () { client.connection().flush(); return true; });
+  check(listener.read(expected.size()) == expected, "backlog delivered");
+}
+
+static void checkReconnect() {
+  StreamListener listener;
+  StreamClient client(listener.port(), OSCStreamConnection::SIZE_PREFIX);
+  const bool isAccepted = listener.accept() && client.waitConnected();
+  check(isAccepted, "reconnect: first connect");
+  if (!isAccepted) return;
+
+  // Only a write notices the receiver is gone, the first ones may still
+  // be accepted by the kernel.
+  listener.drop();
+  const std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + kTimeout;
+  bool isDisconnected = false;
+  while (!isDisconnected && std::chrono::steady_clock::now() < deadline) {
+    client.send(kSpecialPacket);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    isDisconnected = !client.run([&] () { return client.connection().isConnected(); });
+  }
+  check(isDisconnected && client.errors() > 0, "reconnect: error noticed and counted");
+  check(!client.send(kSpecialPacket), "reconnect: dropped while disconnected");
+
+  const bool isReaccepted = listener.accept() && client.waitConnected();
+  check(isReaccepted, "reconnect: connected again");
+  if (!isReaccepted) return;
+
+  client.send(kSpecialPacket);
+  const std::string expected = std::string("\0\0\0\x05", 4) + kSpecialPacket;
+  check(listener.read(expected.size()) == expected, "reconnect: delivered after");
+}
+
+int main() {
+  checkSlip();
+  checkSizePrefix();
+  checkBacklogCap();
+  checkReconnect();
+  return gFailures == 0 ? 0 : 1;
+}
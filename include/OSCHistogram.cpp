@@ -0,0 +1,111 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Four buckets per power of two up to 2^40 ns, about 18 minutes, so any
+// bucket is at most 25% wide.
+const size_t kHistogramSubBuckets = 4;
+const size_t kHistogramBuckets = 40 * kHistogramSubBuckets;
+
+// Nanoseconds on the steady clock, for durations only.
+inline uint64_t getSteadyTime() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+// Fixed-bucket, log-scale histogram of durations in nanoseconds. Recording
+// is a couple of relaxed atomic loads and stores, never a lock or an
+// allocation, so it can sit on the I/O thread's hot path.
+//
+// One writer thread, readers on any thread. clear() while recording may
+// lose the odd concurrent count.
+class OSCHistogram {
+  public:
+  OSCHistogram() {
+    clear();
+  }
+
+  void clear() {
+    for (std::atomic<uint64_t>& bucket : _buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    _max.store(0, std::memory_order_relaxed);
+  }
+
+  void record(uint64_t ns) {
+    std::atomic<uint64_t>& bucket = _buckets[index(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > _max.load(std::memory_order_relaxed)) {
+      _max.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t count() const {
+    uint64_t total = 0;
+    for (const std::atomic<uint64_t>& bucket : _buckets) {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  uint64_t max() const {
+    return _max.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket holding the given percentile, capped at the
+  // maximum, 0 when empty.
+  uint64_t percentile(double p) const {
+    const uint64_t total = count();
+    if (total == 0) return 0;
+
+    const uint64_t rank = (uint64_t) (p / 100. * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kHistogramBuckets; i++) {
+      seen += _buckets[i].load(std::memory_order_relaxed);
+      if (seen >= rank) return std::min(lowerBound(i + 1), max());
+    }
+    return max();
+  }
+
+  // A summary line, then one "from_ns count" line per non-empty bucket.
+  void write(FILE* file, const char* name) const {
+    fprintf(
+      file,
+      "# %s: %llu samples, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+      name,
+      (unsigned long long) count(),
+      (unsigned long long) percentile(50.),
+      (unsigned long long) percentile(99.),
+      (unsigned long long) percentile(99.9),
+      (unsigned long long) max()
+    );
+    for (size_t i = 0; i < kHistogramBuckets; i++) {
+      const uint64_t n = _buckets[i].load(std::memory_order_relaxed);
+      if (n == 0) continue;
+      fprintf(file, "%llu %llu\n", (unsigned long long) lowerBound(i), (unsigned long long) n);
+    }
+  }
+
+  private:
+  // Below 4 ns every value has its own bucket, above that the top bit
+  // picks the octave and the two bits after it the bucket within.
+  static size_t index(uint64_t ns) {
+    if (ns < kHistogramSubBuckets) return (size_t) ns;
+    const size_t msb = 63 - __builtin_clzll(ns);
+    const size_t i = (msb - 1) * kHistogramSubBuckets + ((ns >> (msb - 2)) & 3);
+    return i < kHistogramBuckets ? i : kHistogramBuckets - 1;
+  }
+
+  static uint64_t lowerBound(size_t i) {
+    if (i < kHistogramSubBuckets) return i;
+    const size_t msb = i / kHistogramSubBuckets + 1;
+    return (uint64_t) (kHistogramSubBuckets + i % kHistogramSubBuckets) << (msb - 2);
+  }
+
+  std::atomic<uint64_t> _buckets[kHistogramBuckets];
+  std::atomic<uint64_t> _max;
+};
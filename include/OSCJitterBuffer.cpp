@@ -0,0 +1,89 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include "OSCSample.cpp"
+
+const size_t kJitterBufferSize = 256;
+
+// Holds timetagged samples on the engine thread until the frame their
+// timetag maps to, so network jitter turns into a fixed playout delay.
+// Samples live in a bounded min-heap ordered by timetag; a frame only
+// costs a look at the earliest one.
+//
+// Engine thread only.
+class OSCJitterBuffer {
+  public:
+  OSCJitterBuffer():
+    _size(0),
+    _delay(0),
+    _late(0),
+    _now(0) {
+  }
+
+  // Added to every timetag. Values arriving later than timetag plus delay
+  // go out on the next frame and count as late.
+  void setDelay(float seconds) {
+    _delay = (uint64_t) (seconds * 4294967296.0);
+  }
+
+  void clear() {
+    _size = 0;
+  }
+
+  // Call when the sample rate changes.
+  void resetClock() {
+    _timebase.reset();
+  }
+
+  bool empty() const {
+    return _size == 0;
+  }
+
+  bool isFull() const {
+    return _size == kJitterBufferSize;
+  }
+
+  uint64_t late() const {
+    return _late;
+  }
+
+  // Maps the frame to wall clock time. Call once per frame before
+  // push() and isDue().
+  void advance(int64_t frame, float sampleRate) {
+    _timebase.update(frame, sampleRate);
+    _now = _timebase.timetag(frame);
+  }
+
+  // The buffer must not be full, release top() first if it is.
+  void push(const OSCSample& sample) {
+    if (sample.time + _delay < _now) _late++;
+    _heap[_size++] = sample;
+    std::push_heap(_heap.begin(), _heap.begin() + _size, later);
+  }
+
+  // Whether the earliest sample is due in the current frame.
+  bool isDue() const {
+    return _size > 0 && _heap[0].time + _delay <= _now;
+  }
+
+  const OSCSample& top() const {
+    return _heap[0];
+  }
+
+  void pop() {
+    std::pop_heap(_heap.begin(), _heap.begin() + _size, later);
+    _size--;
+  }
+
+  private:
+  static bool later(const OSCSample& a, const OSCSample& b) {
+    return a.time > b.time;
+  }
+
+  std::array<OSCSample, kJitterBufferSize> _heap;
+  size_t _size;
+  uint64_t _delay;
+  uint64_t _late;
+  OSCTimebase _timebase;
+  uint64_t _now;
+};
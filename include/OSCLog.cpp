@@ -0,0 +1,22 @@
+#pragma once
+
+// The OSC classes only need Rack for its logging macros. Headless builds
+// such as the benchmarks define OSC_HEADLESS and log to stderr instead,
+// so they compile without the Rack SDK. There logging is off unless the
+// OSC_DEBUG environment variable is set, so it does not skew timed runs.
+#if defined(OSC_HEADLESS)
+#include <cstdio>
+#include <cstdlib>
+
+inline bool isDebugLogging() {
+  static const bool isEnabled = std::getenv("OSC_DEBUG") != nullptr;
+  return isEnabled;
+}
+
+#define DEBUG(format, ...) \
+  do { \
+    if (isDebugLogging()) fprintf(stderr, format "\n", ##__VA_ARGS__); \
+  } while (0)
+#else
+#include "plugin.hpp"
+#endif
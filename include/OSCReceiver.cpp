@@ -0,0 +1,491 @@
+#pragma once
+#include "OSCLog.cpp"
+#include <atomic>
+#include <cassert>
+#include <array>
+#include <boost/asio.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <oscpp/server.hpp>
+#include "OSCSample.cpp"
+#include "OSCRouter.cpp"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <cerrno>
+#define OSC_USE_RECVMMSG 1
+#endif
+
+using boost::asio::ip::udp;
+
+// Datagrams pulled from the socket per recvmmsg() call.
+const size_t kReceiveBufferCount = 32;
+const size_t kReceiveBufferAlignment = 64;
+// Room for bursts while the receiver thread is busy parsing.
+const int kReceiveSocketBufferSize = 1 << 20;
+
+// The OSC timetag meaning "now".
+const uint64_t kImmediateTime = 1;
+// Timetagged samples waiting for the engine thread, the same depth as the
+// sender's ring.
+const size_t kScheduledQueueSize = 256;
+
+// Hands the most recent value from one writer thread to one reader thread.
+// Neither side ever waits: the writer fills its private slot and swaps it
+// with the shared one, the reader swaps its slot with the shared one only
+// when a newer value was published. Values the reader did not pick up in
+// time are overwritten, which is what a control signal wants.
+template <typename T>
+class OSCLatestValue {
+  public:
+  OSCLatestValue(): _write(0), _shared(1), _read(2) {
+  }
+
+  // Writer thread. Fill the slot, then publish() it.
+  T& writeSlot() {
+    return _slots[_write];
+  }
+
+  void publish() {
+    _write = _shared.exchange(_write | kFresh, std::memory_order_acq_rel) & kIndex;
+  }
+
+  // Reader thread. Returns the newest published value, or nullptr if
+  // nothing was published since the last call. The pointer stays valid
+  // until the next call.
+  const T* consume() {
+    if (!(_shared.load(std::memory_order_relaxed) & kFresh)) return nullptr;
+    _read = _shared.exchange(_read, std::memory_order_acq_rel) & kIndex;
+    return &_slots[_read];
+  }
+
+  private:
+  static const uint8_t kIndex = 0x3;
+  static const uint8_t kFresh = 0x4;
+
+  std::array<T, 3> _slots;
+  uint8_t _write;
+  std::atomic<uint8_t> _shared;
+  uint8_t _read;
+};
+
+// Listens on a UDP port on a thread of its own. Every datagram is parsed
+// right there, and the arguments of the last message matching the address
+// end up in an OSCSample that the engine thread picks up through an
+// OSCLatestValue, so process() neither blocks nor allocates.
+//
+// On Linux datagrams are read with recvmmsg() straight into a ring of
+// preallocated, cache line aligned buffers, up to kReceiveBufferCount per
+// system call, and parsed in place. Datagrams the kernel had to discard
+// because the socket queue was full are counted as drops.
+//
+// Arguments map to outputs like CVtoOSC maps inputs to arguments: a float
+// or int is one channel, an array is one channel per element.
+//
+// With scheduling on, messages from bundles with a timetag other than
+// "immediately" go through a queue instead, for the engine thread to play
+// them out at the right frame with an OSCJitterBuffer.
+class OSCReceiver final {
+  public:
+  OSCReceiver():
+    _io_service(),
+    _work_guard(_io_service.get_executor()),
+    _socket(_io_service),
+    _is_running(false),
+    _is_listening(false),
+    _is_scheduling(false),
+    _received(0),
+    _errors(0),
+    _dropped(0),
+    _ring_storage(kReceiveBufferCount * kMaxPacketSize + kReceiveBufferAlignment) {
+    // Align the ring by hand, over-aligned allocation is C++17.
+    size_t space = _ring_storage.size();
+    void* ring = _ring_storage.data();
+    _ring = static_cast<char*>(std::align(
+      kReceiveBufferAlignment,
+      kReceiveBufferCount * kMaxPacketSize,
+      ring,
+      space
+    ));
+  }
+
+  OSCReceiver(const OSCReceiver&) = delete;
+  OSCReceiver& operator=(const OSCReceiver&) = delete;
+
+  ~OSCReceiver() {
+    stop();
+  }
+
+  void start() {
+    DEBUG("starting receiver...");
+    assert(!_is_running.load(std::memory_order_relaxed));
+    _is_running.store(true, std::memory_order_relaxed);
+    _io_thread = std::thread([this] () {
+      _io_service.run();
+    });
+    DEBUG("receiver started");
+  }
+
+  void stop() {
+    if (!_is_running.exchange(false, std::memory_order_relaxed)) return;
+
+    boost::asio::post(_io_service, [this] () {
+      close();
+      _work_guard.reset();
+    });
+    if (_io_thread.joinable()) {
+      _io_thread.join();
+    }
+    DEBUG("receiver stopped");
+  }
+
+  // Rebinds the socket on the receiver thread, port 0 stops listening.
+  void setPort(uint16_t port) {
+    boost::asio::post(_io_service, [this, port] () {
+      close();
+      if (port != 0) listen(port);
+    });
+  }
+
+  // A comma separated list of addresses or OSC patterns, e.g.
+  // "/cv, /mixer/*/fader, /synth/{a,b}". Commas inside braces belong to
+  // the pattern. An empty list matches every message. Returns false if an
+  // entry is malformed, nothing matches until it is fixed.
+  bool setAddress(const std::string& address) {
+    OSCRouter router;
+    bool isValid = true;
+
+    size_t begin = 0;
+    while (begin < address.size()) {
+      size_t end = findSeparator(address, begin);
+
+      size_t first = address.find_first_not_of(' ', begin);
+      size_t last = address.find_last_not_of(' ', end - 1);
+      if (first < end && !router.add(address.substr(first, last - first + 1), 0)) {
+        DEBUG("Address is wrong %s", address.c_str());
+        isValid = false;
+      }
+      begin = end + 1;
+    }
+
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    std::swap(_router, router);
+    _is_address_valid = isValid;
+    return isValid;
+  }
+
+  void setScheduling(bool isScheduling) {
+    _is_scheduling.store(isScheduling, std::memory_order_relaxed);
+  }
+
+  bool isListening() const {
+    return _is_listening.load(std::memory_order_relaxed);
+  }
+
+  // Messages that matched the address.
+  uint64_t received() const {
+    return _received.load(std::memory_order_relaxed);
+  }
+
+  // Datagrams that were not valid OSC or did not fit kMaxPacketSize.
+  uint64_t errors() const {
+    return _errors.load(std::memory_order_relaxed);
+  }
+
+  // Datagrams the kernel dropped before they could be read, which is only
+  // known on Linux, plus timetagged messages that found the schedule queue
+  // full.
+  uint64_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // Engine thread. The latest immediate value, see OSCLatestValue.
+  const OSCSample* consume() {
+    return _values.consume();
+  }
+
+  // Engine thread. The next timetagged value, in order of arrival.
+  bool consumeScheduled(OSCSample& sample) {
+    return _scheduled.pop(sample);
+  }
+
+  private:
+  // The next ',' at or after begin that is not inside braces, or the end
+  // of the list.
+  static size_t findSeparator(const std::string& address, size_t begin) {
+    bool isInBraces = false;
+    for (size_t i = begin; i < address.size(); i++) {
+      const char c = address[i];
+      if (c == '{') isInBraces = true;
+      else if (c == '}') isInBraces = false;
+      else if (c == ',' && !isInBraces) return i;
+    }
+    return address.size();
+  }
+
+  void listen(uint16_t port) {
+    boost::system::error_code error;
+    _socket.open(udp::v4(), error);
+    if (!error) {
+      _socket.bind(udp::endpoint(udp::v4(), port), error);
+    }
+    if (!error) {
+      boost::system::error_code ignored;
+      _socket.set_option(
+        udp::socket::receive_buffer_size(kReceiveSocketBufferSize),
+        ignored
+      );
+    }
+#if defined(OSC_USE_RECVMMSG)
+    if (!error) {
+      _socket.non_blocking(true, error);
+    }
+    if (!error) {
+      int enable = 1;
+      ::setsockopt(
+        _socket.native_handle(),
+        SOL_SOCKET,
+        SO_RXQ_OVFL,
+        &enable,
+        sizeof(enable)
+      );
+      _kernel_drops = 0;
+    }
+#endif
+    if (error) {
+      DEBUG("error listening on port %d %s", port, error.message().c_str());
+      close();
+      return;
+    }
+
+    DEBUG("listening on port %d", port);
+    _is_listening.store(true, std::memory_order_relaxed);
+    receive();
+  }
+
+  void close() {
+    _is_listening.store(false, std::memory_order_relaxed);
+    boost::system::error_code ignored;
+    _socket.close(ignored);
+  }
+
+#if defined(OSC_USE_RECVMMSG)
+  void receive() {
+    _socket.async_wait(
+      udp::socket::wait_read,
+      [this] (boost::system::error_code error) {
+        if (error == boost::asio::error::operation_aborted) return;
+        if (error) {
+          DEBUG("error receiving message %s", error.message().c_str());
+        }
+        else {
+          receiveBatches();
+        }
+        receive();
+      }
+    );
+  }
+
+  // Drains the socket queue, a full batch means there may be more.
+  void receiveBatches() {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    const int fd = _socket.native_handle();
+
+    for (;;) {
+      for (size_t i = 0; i < kReceiveBufferCount; i++) {
+        _iovecs[i].iov_base = _ring + i * kMaxPacketSize;
+        _iovecs[i].iov_len = kMaxPacketSize;
+
+        msghdr& header = _headers[i].msg_hdr;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_iov = &_iovecs[i];
+        header.msg_iovlen = 1;
+        header.msg_control = _controls[i].data;
+        header.msg_controllen = sizeof(_controls[i].data);
+      }
+
+      int count = ::recvmmsg(fd, _headers.data(), kReceiveBufferCount, 0, nullptr);
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          DEBUG("error receiving message %s", std::strerror(errno));
+        }
+        return;
+      }
+
+      for (int i = 0; i < count; i++) {
+        const msghdr& header = _headers[i].msg_hdr;
+        if (header.msg_flags & MSG_TRUNC) {
+          _errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+          parse(_ring + i * kMaxPacketSize, _headers[i].msg_len);
+        }
+      }
+      if (count > 0) {
+        updateDrops(_headers[count - 1].msg_hdr);
+      }
+
+      if ((size_t) count < kReceiveBufferCount) return;
+    }
+  }
+
+  // SO_RXQ_OVFL attaches the socket's running count of dropped datagrams.
+  void updateDrops(const msghdr& header) {
+    for (
+      const cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+      cmsg != nullptr;
+      cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&header), const_cast<cmsghdr*>(cmsg))
+    ) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL) continue;
+
+      uint32_t drops;
+      std::memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+      _dropped.fetch_add(drops - _kernel_drops, std::memory_order_relaxed);
+      _kernel_drops = drops;
+    }
+  }
+#else
+  void receive() {
+    _socket.async_receive(
+      boost::asio::buffer(_ring, kMaxPacketSize),
+      [this] (boost::system::error_code error, std::size_t size) {
+        if (error == boost::asio::error::operation_aborted) return;
+        if (error) {
+          DEBUG("error receiving message %s", error.message().c_str());
+        }
+        else {
+          std::lock_guard<std::mutex> lock(_config_mutex);
+          parse(_ring, size);
+        }
+        receive();
+      }
+    );
+  }
+#endif
+
+  // Parses the datagram where it is, the arguments are read straight out
+  // of the receive buffer. Called with the config mutex held.
+  void parse(const void* data, size_t size) {
+    try {
+      parsePacket(OSCPP::Server::Packet(data, size), kImmediateTime);
+    }
+    catch (const OSCPP::Error &e) {
+      DEBUG("error parsing message %s", e.what());
+      _errors.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Messages outside of a bundle are immediate.
+  void parsePacket(const OSCPP::Server::Packet& packet, uint64_t time) {
+    if (packet.isBundle()) {
+      OSCPP::Server::Bundle bundle(packet);
+      OSCPP::Server::PacketStream packets(bundle.packets());
+      while (!packets.atEnd()) {
+        parsePacket(packets.next(), bundle.time());
+      }
+      return;
+    }
+
+    OSCPP::Server::Message message(packet);
+    if (!matches(message.address())) return;
+
+    if (time != kImmediateTime && _is_scheduling.load(std::memory_order_relaxed)) {
+      OSCSample sample;
+      sample.time = time;
+      decode(message.args(), sample);
+      if (!_scheduled.push(sample)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    else {
+      OSCSample& sample = _values.writeSlot();
+      sample.time = time;
+      decode(message.args(), sample);
+      _values.publish();
+    }
+    _received.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool matches(const char* address) const {
+    if (!_is_address_valid) return false;
+    if (_router.empty()) return true;
+
+    bool isMatch = false;
+    _router.dispatch(address, [&isMatch] (size_t) {
+      isMatch = true;
+    });
+    return isMatch;
+  }
+
+  static void decode(OSCPP::Server::ArgStream args, OSCSample& sample) {
+    size_t offset = 0;
+    size_t output = 0;
+    while (output < kMaxInputs && !args.atEnd()) {
+      const char tag = args.tag();
+      if (tag == '[') {
+        OSCPP::Server::ArgStream array(args.array());
+        size_t channels = 0;
+        while (channels < kMaxChannels && !array.atEnd()) {
+          if (array.tag() == 'f' || array.tag() == 'i') {
+            sample.values[offset + channels++] = array.float32();
+          }
+          else {
+            array.drop();
+          }
+        }
+        sample.channels[output++] = (uint8_t) channels;
+        offset += channels;
+      }
+      else if (tag == 'f' || tag == 'i') {
+        sample.values[offset++] = args.float32();
+        sample.channels[output++] = 1;
+      }
+      else {
+        args.drop();
+      }
+    }
+    for (; output < kMaxInputs; output++) {
+      sample.channels[output] = 0;
+    }
+  }
+
+  using work_guard_t = boost::asio::executor_work_guard<
+    boost::asio::io_context::executor_type
+  >;
+
+  boost::asio::io_service _io_service;
+  work_guard_t _work_guard;
+  std::thread _io_thread;
+  udp::socket _socket;
+  std::atomic<bool> _is_running;
+  std::atomic<bool> _is_listening;
+  std::atomic<bool> _is_scheduling;
+  std::atomic<uint64_t> _received;
+  std::atomic<uint64_t> _errors;
+  std::atomic<uint64_t> _dropped;
+  std::vector<char> _ring_storage;
+  char* _ring;
+#if defined(OSC_USE_RECVMMSG)
+  std::array<mmsghdr, kReceiveBufferCount> _headers;
+  std::array<iovec, kReceiveBufferCount> _iovecs;
+  struct Control {
+    alignas(cmsghdr) char data[CMSG_SPACE(sizeof(uint32_t))];
+  };
+  std::array<Control, kReceiveBufferCount> _controls;
+  uint32_t _kernel_drops = 0;
+#endif
+  std::mutex _config_mutex;
+  OSCRouter _router;
+  bool _is_address_valid = true;
+  OSCLatestValue<OSCSample> _values;
+  boost::lockfree::spsc_queue<
+    OSCSample,
+    boost::lockfree::capacity<kScheduledQueueSize>
+  > _scheduled;
+};
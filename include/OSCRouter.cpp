@@ -0,0 +1,312 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Matches incoming OSC addresses against registered routes. Routes are
+// plain addresses or OSC 1.0 patterns ('*', '?', '[a-z]', '[!a-z]' and
+// '{foo,bar}') and get compiled into a trie with one node per address
+// segment. Literal segments are found through a hash table in each node,
+// so a dispatch costs one hash probe per segment however many routes are
+// registered, plus a match against every pattern segment on the way.
+// Incoming addresses may be patterns too, they are matched against the
+// literal routes.
+//
+// add() and clear() allocate, dispatch() does not.
+class OSCRouter {
+  public:
+  OSCRouter() {
+    clear();
+  }
+
+  void clear() {
+    _nodes.clear();
+    _nodes.push_back(Node());
+    _size = 0;
+  }
+
+  size_t size() const {
+    return _size;
+  }
+
+  bool empty() const {
+    return _size == 0;
+  }
+
+  // Returns false, and leaves the router unchanged, if the route is not
+  // a valid address or pattern.
+  bool add(const std::string& route, size_t id) {
+    if (route.empty() || route[0] != '/' || !isValidPattern(route)) return false;
+
+    size_t node = 0;
+    size_t begin = 1;
+    while (begin <= route.size()) {
+      size_t end = route.find('/', begin);
+      if (end == std::string::npos) end = route.size();
+
+      node = child(node, route.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    _nodes[node].routes.push_back(id);
+    _size++;
+    return true;
+  }
+
+  // Calls callback(id) for every route matching address. A route matched
+  // along several paths, e.g. "/a/*" and "/a/b" both registered with the
+  // same id, is reported once per path.
+  template <typename Callback>
+  void dispatch(const char* address, Callback callback) const {
+    if (address[0] != '/') return;
+    dispatch(0, address + 1, callback);
+  }
+
+  private:
+  struct Node {
+    std::string segment;
+    uint64_t hash = 0;
+    std::vector<size_t> routes;
+    // Open addressing over literal children, node index + 1, 0 is empty.
+    std::vector<size_t> literals;
+    size_t literalsSize = 0;
+    std::vector<size_t> patterns;
+  };
+
+  static const char* segmentEnd(const char* begin) {
+    const char* end = std::strchr(begin, '/');
+    return end ? end : begin + std::strlen(begin);
+  }
+
+  static uint64_t hashSegment(const char* begin, const char* end) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = begin; c < end; c++) {
+      hash = (hash ^ (uint8_t) *c) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  static bool isPatternChar(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '{';
+  }
+
+  static bool isPatternSegment(const char* begin, const char* end) {
+    for (const char* c = begin; c < end; c++) {
+      if (isPatternChar(*c)) return true;
+    }
+    return false;
+  }
+
+  // Spaces and '#' are never allowed, ',' ']' and '}' only inside the
+  // brackets or braces they belong to, which have to close within their
+  // segment.
+  static bool isValidPattern(const std::string& route) {
+    for (size_t i = 0; i < route.size(); i++) {
+      const char c = route[i];
+      if (c == ' ' || c == '#' || c == ',' || c == ']' || c == '}') return false;
+      if (c == '[' || c == '{') {
+        const char close = c == '[' ? ']' : '}';
+        size_t j = i + 1;
+        while (j < route.size() && route[j] != close && route[j] != '/') j++;
+        if (j == route.size() || route[j] != close) return false;
+        i = j;
+      }
+    }
+    return true;
+  }
+
+  size_t child(size_t parent, const std::string& segment) {
+    const char* begin = segment.c_str();
+    const char* end = begin + segment.size();
+
+    if (isPatternSegment(begin, end)) {
+      for (size_t index : _nodes[parent].patterns) {
+        if (_nodes[index].segment == segment) return index;
+      }
+      size_t index = newNode(segment);
+      _nodes[parent].patterns.push_back(index);
+      return index;
+    }
+
+    size_t found = findLiteral(_nodes[parent], begin, end);
+    if (found != 0) return found - 1;
+
+    size_t index = newNode(segment);
+    insertLiteral(parent, index);
+    return index;
+  }
+
+  size_t newNode(const std::string& segment) {
+    Node node;
+    node.segment = segment;
+    node.hash = hashSegment(segment.c_str(), segment.c_str() + segment.size());
+    _nodes.push_back(node);
+    return _nodes.size() - 1;
+  }
+
+  // Keeps the table at most half full, sizes are powers of two.
+  void insertLiteral(size_t parent, size_t index) {
+    Node& node = _nodes[parent];
+    if (2 * (node.literalsSize + 1) > node.literals.size()) {
+      std::vector<size_t> old;
+      old.swap(node.literals);
+      node.literals.assign(std::max<size_t>(8, 2 * old.size()), 0);
+      for (size_t entry : old) {
+        if (entry != 0) placeLiteral(node, entry);
+      }
+    }
+    placeLiteral(node, index + 1);
+    node.literalsSize++;
+  }
+
+  void placeLiteral(Node& node, size_t entry) {
+    const size_t mask = node.literals.size() - 1;
+    size_t slot = _nodes[entry - 1].hash & mask;
+    while (node.literals[slot] != 0) slot = (slot + 1) & mask;
+    node.literals[slot] = entry;
+  }
+
+  // Returns the child index + 1, or 0 if there is none.
+  size_t findLiteral(const Node& node, const char* begin, const char* end) const {
+    if (node.literals.empty()) return 0;
+
+    const size_t length = end - begin;
+    const uint64_t hash = hashSegment(begin, end);
+    const size_t mask = node.literals.size() - 1;
+    for (size_t slot = hash & mask; node.literals[slot] != 0; slot = (slot + 1) & mask) {
+      const Node& candidate = _nodes[node.literals[slot] - 1];
+      if (
+        candidate.hash == hash &&
+        candidate.segment.size() == length &&
+        std::memcmp(candidate.segment.data(), begin, length) == 0
+      ) {
+        return node.literals[slot];
+      }
+    }
+    return 0;
+  }
+
+  template <typename Callback>
+  void dispatch(size_t index, const char* segment, Callback& callback) const {
+    const Node& node = _nodes[index];
+    const char* end = segmentEnd(segment);
+    const char* next = *end == '/' ? end + 1 : nullptr;
+
+    if (isPatternSegment(segment, end)) {
+      // A pattern coming in, try it on every literal child.
+      for (size_t entry : node.literals) {
+        if (entry == 0) continue;
+        const Node& child = _nodes[entry - 1];
+        const char* childSegment = child.segment.c_str();
+        if (matchSegment(segment, end, childSegment, childSegment + child.segment.size())) {
+          visit(entry - 1, next, callback);
+        }
+      }
+    }
+    else {
+      size_t found = findLiteral(node, segment, end);
+      if (found != 0) visit(found - 1, next, callback);
+    }
+
+    for (size_t patternIndex : node.patterns) {
+      const Node& child = _nodes[patternIndex];
+      const char* pattern = child.segment.c_str();
+      if (matchSegment(pattern, pattern + child.segment.size(), segment, end)) {
+        visit(patternIndex, next, callback);
+      }
+    }
+  }
+
+  template <typename Callback>
+  void visit(size_t index, const char* next, Callback& callback) const {
+    if (next == nullptr) {
+      for (size_t id : _nodes[index].routes) callback(id);
+    }
+    else {
+      dispatch(index, next, callback);
+    }
+  }
+
+  // OSC 1.0 pattern matching over [pattern, patternEnd) and [s, end).
+  static bool matchSegment(
+    const char* pattern,
+    const char* patternEnd,
+    const char* s,
+    const char* end
+  ) {
+    while (pattern < patternEnd) {
+      switch (*pattern) {
+        case '*': {
+          while (pattern < patternEnd && *pattern == '*') pattern++;
+          if (pattern == patternEnd) {
+            return std::find(s, end, '/') == end;
+          }
+          for (const char* rest = s; rest <= end; rest++) {
+            if (matchSegment(pattern, patternEnd, rest, end)) return true;
+            if (rest < end && *rest == '/') return false;
+          }
+          return false;
+        }
+        case '?':
+          if (s == end || *s == '/') return false;
+          pattern++;
+          s++;
+          break;
+        case '[': {
+          if (s == end) return false;
+          const char* close = std::find(pattern, patternEnd, ']');
+          if (close == patternEnd) return false;
+          if (!matchBracket(pattern + 1, close, *s)) return false;
+          pattern = close + 1;
+          s++;
+          break;
+        }
+        case '{': {
+          const char* close = std::find(pattern, patternEnd, '}');
+          if (close == patternEnd) return false;
+          const char* option = pattern + 1;
+          while (option <= close) {
+            const char* optionEnd = std::find(option, close, ',');
+            const size_t length = optionEnd - option;
+            if (
+              (size_t) (end - s) >= length &&
+              std::memcmp(option, s, length) == 0 &&
+              matchSegment(close + 1, patternEnd, s + length, end)
+            ) {
+              return true;
+            }
+            option = optionEnd + 1;
+          }
+          return false;
+        }
+        default:
+          if (s == end || *s != *pattern) return false;
+          pattern++;
+          s++;
+      }
+    }
+    return s == end;
+  }
+
+  // The contents of [...], "!" negates, "a-z" is a range.
+  static bool matchBracket(const char* begin, const char* end, char c) {
+    bool negate = begin < end && *begin == '!';
+    if (negate) begin++;
+
+    bool found = false;
+    for (const char* p = begin; p < end; p++) {
+      if (p + 2 < end && p[1] == '-') {
+        if (c >= p[0] && c <= p[2]) found = true;
+        p += 2;
+      }
+      else if (*p == c) {
+        found = true;
+      }
+    }
+    return found != negate;
+  }
+
+  std::vector<Node> _nodes;
+  size_t _size;
+};
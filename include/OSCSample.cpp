@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/time.h>
+
+// What the sending and the receiving side share: the sample record, the
+// largest packet either side handles, and NTP time.
+
+const size_t kMaxPacketSize = 8192;
+const size_t kMaxInputs = 2;
+const size_t kMaxChannels = 16;
+
+#define MICROS_PER_SEC         1000000
+#define us2s(x) (((double)x)/(double)MICROS_PER_SEC)
+
+inline timeval getCurrentTime() {
+  struct timeval tv{};
+  gettimeofday(&tv, nullptr);
+  return tv;
+}
+
+inline uint64_t formatTime(timeval tv) {
+  return (
+    ((uint64_t) tv.tv_sec + 2208988800L) << 32 |
+    ((uint32_t) (us2s(tv.tv_usec) * (double)4294967296L))
+  );
+}
+
+// The engine runs off the audio clock, timetags off the wall clock. The
+// two are compared once per second of frames and the timebase slewed back
+// when they drifted further apart than this.
+const uint64_t kMaxClockDrift = (uint64_t) (0.002 * 4294967296.0);
+
+// Maps engine frames to 64-bit NTP timetags. The wall clock is read when
+// anchoring and once per second of frames after that, every timetag is
+// derived from the frame count with integer math, so timetags are
+// sample-accurate and do not jitter with engine block scheduling.
+//
+// Drift beyond kMaxClockDrift is not corrected with a jump but spread
+// over at least a second of frames, at most half the nominal rate, so
+// timetags stay monotonic even when the wall clock is stepped. Reset when
+// the sample rate changes.
+class OSCTimebase {
+  public:
+  OSCTimebase():
+    _frame(0),
+    _sample_rate(0),
+    _time(0),
+    _correction(0),
+    _slew_frames(0),
+    _next_clock_check(0) {
+  }
+
+  void anchor(int64_t frame, uint32_t sampleRate, uint64_t time) {
+    _frame = frame;
+    _sample_rate = sampleRate;
+    _time = time;
+    _correction = 0;
+    _slew_frames = 0;
+    _next_clock_check = frame + sampleRate;
+  }
+
+  void reset() {
+    _sample_rate = 0;
+  }
+
+  bool isAnchored() const {
+    return _sample_rate > 0;
+  }
+
+  // Anchors on first use and checks for drift once per second of frames.
+  // Call before timetag(), frames must not go backwards.
+  void update(int64_t frame, float sampleRate) {
+    if (!isAnchored()) {
+      anchor(
+        frame,
+        (uint32_t) std::lround(sampleRate),
+        formatTime(getCurrentTime())
+      );
+      return;
+    }
+    if (frame < _next_clock_check) return;
+
+    const uint64_t engineTime = timetag(frame);
+    const int64_t drift = (int64_t) (formatTime(getCurrentTime()) - engineTime);
+    if ((uint64_t) std::llabs(drift) > kMaxClockDrift) {
+      // Restarts from where the timetags are now, including any slew
+      // still under way.
+      const uint64_t driftFrames =
+        (uint64_t) (((double) std::llabs(drift) / 4294967296.0) * _sample_rate);
+      _frame = frame;
+      _time = engineTime;
+      _correction = drift;
+      _slew_frames = std::max<uint64_t>(_sample_rate, 2 * driftFrames);
+    }
+    _next_clock_check = frame + _sample_rate;
+  }
+
+  uint64_t timetag(int64_t frame) const {
+    const uint64_t frames = frame > _frame ? (uint64_t) (frame - _frame) : 0;
+    const uint64_t seconds = frames / _sample_rate;
+    const uint64_t rest = frames % _sample_rate;
+    uint64_t time = _time + (seconds << 32) + ((rest << 32) / _sample_rate);
+    if (_slew_frames > 0) {
+      time += frames >= _slew_frames
+        ? (uint64_t) _correction
+        : (uint64_t) (int64_t) ((double) _correction * frames / _slew_frames);
+    }
+    return time;
+  }
+
+  private:
+  int64_t _frame;
+  uint32_t _sample_rate;
+  uint64_t _time;
+  // NTP units added linearly over the _slew_frames frames after _frame.
+  int64_t _correction;
+  uint64_t _slew_frames;
+  int64_t _next_clock_check;
+};
+
+// Fixed-size record handed from the engine thread to the I/O thread.
+// Everything variable-sized (address, endpoint) stays on the sender.
+// values holds the channels of every input back to back, input i starts
+// right after the channels[i - 1] values of the previous one.
+struct OSCSample {
+  uint64_t time; // NTP timetag
+  uint8_t channels[kMaxInputs];
+  float values[kMaxInputs * kMaxChannels];
+  // getSteadyTime() at push().
+  uint64_t pushTime = 0;
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "OSCSample.cpp"
+
+// Free-running sends are skipped while no channel moved by more than its
+// input's dead band, and forced again after the keepalive interval.
+const float kDeadBands[] = {0.f, 0.001f, 0.005f, 0.01f, 0.05f, 0.1f};
+const float kKeepalives[] = {0.1f, 0.5f, 1.f, 2.f, 5.f};
+const int kDefaultKeepalive = 2;
+
+// One engine frame worth of input. voltages[i] points at channels[i]
+// voltages, an unpatched input is one channel at 0V.
+struct OSCSamplerFrame {
+  const float* voltages[kMaxInputs];
+  int channels[kMaxInputs];
+  bool isTriggerConnected;
+  float trigger;
+  // Seconds between free-running sends.
+  float period;
+  float sampleTime;
+  float sampleRate;
+  int64_t frame;
+};
+
+// The per-frame logic of CVtoOSC without Rack: decides when to send,
+// either on a rising trigger edge or free-running every period with
+// change detection, and fills in the sample with its timetag. Kept apart
+// from the module so it can be driven offline, see bench/sampler.cpp.
+//
+// Engine thread only, apart from the settings, which the UI writes.
+class OSCSampler {
+  public:
+  // Indices into kDeadBands and kKeepalives.
+  int deadBand[kMaxInputs] = {0, 0};
+  int keepalive = kDefaultKeepalive;
+
+  OSCSampler(): _time(0.f), _time_since_send(0.f), _is_trigger_high(false), _last_sent() {
+  }
+
+  void reset() {
+    _time = 0.f;
+    _timebase.reset();
+  }
+
+  // Call when the sample rate changes.
+  void resetClock() {
+    _timebase.reset();
+  }
+
+  // Returns true, with sample filled in, when this frame should be sent.
+  bool process(const OSCSamplerFrame& frame, OSCSample& sample) {
+    _time_since_send += frame.sampleTime;
+
+    // Same thresholds as a Rack SchmittTrigger on the input scaled from
+    // 0..5V to 0..1.
+    if (frame.isTriggerConnected && !processTrigger(frame.trigger / 5.f)) {
+      return false;
+    }
+
+    _time += frame.sampleTime;
+    if (!frame.isTriggerConnected && _time < frame.period) {
+      return false;
+    }
+
+    _time = 0.f;
+
+    readInputs(frame, sample);
+    if (
+      !frame.isTriggerConnected &&
+      _time_since_send < kKeepalives[keepalive] &&
+      !hasChanged(sample)
+    ) {
+      return false;
+    }
+
+    _timebase.update(frame.frame, frame.sampleRate);
+    sample.time = _timebase.timetag(frame.frame);
+    _last_sent = sample;
+    _time_since_send = 0.f;
+    return true;
+  }
+
+  private:
+  bool processTrigger(float in) {
+    if (_is_trigger_high) {
+      if (in <= 0.f) _is_trigger_high = false;
+      return false;
+    }
+    if (in >= 1.f) {
+      _is_trigger_high = true;
+      return true;
+    }
+    return false;
+  }
+
+  // True if a channel moved further than its input's dead band since the
+  // last send, or the channel layout changed. An input without a dead band
+  // counts any change, unless no input has one, then change detection is
+  // off and every frame counts as changed.
+  bool hasChanged(const OSCSample& sample) const {
+    bool isDetecting = false;
+    for (size_t i = 0; i < kMaxInputs; i++) {
+      isDetecting = isDetecting || deadBand[i] != 0;
+    }
+    if (!isDetecting) return true;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < kMaxInputs; i++) {
+      if (sample.channels[i] != _last_sent.channels[i]) return true;
+
+      // Values are normalized, 20V span to 0..1
+      float threshold = kDeadBands[deadBand[i]] / 20.f;
+      for (size_t c = 0; c < sample.channels[i]; c++) {
+        float delta = sample.values[offset + c] - _last_sent.values[offset + c];
+        if (std::fabs(delta) > threshold) return true;
+      }
+      offset += sample.channels[i];
+    }
+    return false;
+  }
+
+  // Normalizes every channel from -10..10V to 0..1. Plain loops over the
+  // contiguous voltages, the compiler vectorizes them.
+  static void readInputs(const OSCSamplerFrame& frame, OSCSample& sample) {
+    size_t offset = 0;
+    for (size_t i = 0; i < kMaxInputs; i++) {
+      const int channels = std::min(std::max(frame.channels[i], 1), (int) kMaxChannels);
+      const float* voltages = frame.voltages[i];
+      float* values = &sample.values[offset];
+      for (int c = 0; c < channels; c++) {
+        values[c] = (std::min(std::max(voltages[c], -10.f), 10.f) + 10.f) / 20.f;
+      }
+
+      sample.channels[i] = channels;
+      offset += channels;
+    }
+  }
+
+  float _time;
+  float _time_since_send;
+  bool _is_trigger_high;
+  OSCSample _last_sent;
+  OSCTimebase _timebase;
+};
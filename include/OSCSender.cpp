@@ -1,38 +1,34 @@
-#include "plugin.hpp"
+#pragma once
+#include "OSCLog.cpp"
+#include <algorithm>
 #include <atomic>
+#include <cassert>
 #include <iterator>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
-#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <exception>
 #include <iostream>
 #include <array>
+#include <chrono>
 #include <stdexcept>
+#include <mutex>
 #include <stdio.h>
 #include <thread>
 #include <memory>
 #include <unistd.h>
 #include <sys/time.h>
 #include <cstddef>
+#include <cstring>
 #include <oscpp/client.hpp>
 
-#include <nonstd/optional.hpp>
-
-#define MICROS_PER_SEC         1000000
-#define us2s(x) (((double)x)/(double)MICROS_PER_SEC)
-
-// struct timeval tv;
-// gettimeofday(&tv, NULL);
-
-uint64_t formatTime(timeval tv) {
-  return (
-    ((uint64_t) tv.tv_sec + 2208988800L) << 32 |
-    ((uint32_t) (us2s(tv.tv_usec) * (double)4294967296L))
-  );
-}
+#include "OSCSample.cpp"
+#include "OSCTransport.cpp"
+#include "OSCStreamConnection.cpp"
 
 struct OSCMessageValue {
-  enum {FLOAT, INT, STRING} type;
+  // ARRAY_BEGIN and ARRAY_END carry no value, they only emit '[' and ']'.
+  enum {FLOAT, INT, STRING, ARRAY_BEGIN, ARRAY_END} type;
   union {
     float f;
     int i;
@@ -40,37 +36,63 @@ struct OSCMessageValue {
   };
 };
 
+const size_t kMaxAddressSize = 256;
+const size_t kMaxMessageValues = kMaxInputs * (kMaxChannels + 2);
+const size_t kMaxBundleMessages = 4;
+
+// Messages and bundles carry their storage inline so a bundle can be
+// preallocated once and refilled for every send without touching the heap.
 struct OSCMessage {
-  std::string address;
+  char address[kMaxAddressSize];
   size_t valuesSize;
-  OSCMessageValue* values;
+  OSCMessageValue values[kMaxMessageValues];
+
+  void setAddress(const char* newAddress) {
+    strncpy(address, newAddress, kMaxAddressSize - 1);
+    address[kMaxAddressSize - 1] = '\0';
+  }
 };
 
 struct OSCBundle {
-  timeval time;
+  uint64_t time; // NTP timetag
   size_t messagesSize;
-  OSCMessage* messages;
+  OSCMessage messages[kMaxBundleMessages];
 };
 
-size_t makePacket(void* buffer, size_t size, const OSCBundle& bundle) {
+inline size_t makePacket(void* buffer, size_t size, const OSCBundle& bundle) {
   OSCPP::Client::Packet packet(buffer, size);
-  packet = packet.openBundle(formatTime(bundle.time));
+  packet = packet.openBundle(bundle.time);
   for (size_t i = 0; i < bundle.messagesSize; i++) {
-    auto msg = bundle.messages[i];
-    packet = packet.openMessage(msg.address.c_str(), msg.valuesSize);
+    const OSCMessage& msg = bundle.messages[i];
+    packet = packet.openMessage(msg.address, msg.valuesSize);
 
-    for (size_t j = 0; j < msg.valuesSize; j++) {
-      auto val = msg.values[j];
+    for (size_t j = 0; j < msg.valuesSize;) {
+      const OSCMessageValue& val = msg.values[j++];
       switch (val.type) {
-        case OSCMessageValue::FLOAT:
-          packet = packet.float32(val.f);
+        case OSCMessageValue::FLOAT: {
+          // Consecutive floats, array elements included, are written in
+          // one go.
+          float run[kMaxMessageValues];
+          size_t n = 0;
+          run[n++] = val.f;
+          while (j < msg.valuesSize && msg.values[j].type == OSCMessageValue::FLOAT) {
+            run[n++] = msg.values[j++].f;
+          }
+          packet = packet.float32(run, n);
           break;
+        }
         case OSCMessageValue::INT:
           packet = packet.int32(val.i);
           break;
         case OSCMessageValue::STRING:
           packet = packet.string(val.s);
           break;
+        case OSCMessageValue::ARRAY_BEGIN:
+          packet = packet.openArray();
+          break;
+        case OSCMessageValue::ARRAY_END:
+          packet = packet.closeArray();
+          break;
         default:
           throw std::invalid_argument("Message type not supported");
       }
@@ -81,117 +103,668 @@ size_t makePacket(void* buffer, size_t size, const OSCBundle& bundle) {
   return packet.size();
 }
 
-using boost::asio::ip::udp;
+const size_t kMaxTemplateSize = 1024;
+const size_t kMaxTemplateRuns = kMaxBundleMessages * kMaxMessageValues;
+
+// A bundle encoded once with its address, padding and type tags in place.
+// render() copies the cached bytes and only writes the timetag and the
+// float arguments, so a send costs a memcpy plus a byte swap per value.
+// Has to be rebuilt whenever the address or the argument layout changes.
+class OSCMessageTemplate {
+  public:
+  OSCMessageTemplate(): _size(0), _runs_size(0), _slots_size(0) {
+  }
+
+  // Returns false (and leaves the template invalid) if the bundle has
+  // arguments whose encoded size depends on their value, or if it does
+  // not fit. Callers fall back to makePacket() in that case.
+  bool build(const OSCBundle& bundle) {
+    _size = 0;
+    _runs_size = 0;
+    _slots_size = 0;
+
+    try {
+      OSCPP::Client::Packet packet(_packet.data(), kMaxTemplateSize);
+      packet.openBundle(0);
+      for (size_t i = 0; i < bundle.messagesSize; i++) {
+        const OSCMessage& msg = bundle.messages[i];
+        packet.openMessage(msg.address, msg.valuesSize);
+
+        for (size_t j = 0; j < msg.valuesSize; j++) {
+          switch (msg.values[j].type) {
+            case OSCMessageValue::FLOAT:
+              addSlot((uint32_t) packet.size());
+              packet.float32(0.f);
+              break;
+            case OSCMessageValue::ARRAY_BEGIN:
+              packet.openArray();
+              break;
+            case OSCMessageValue::ARRAY_END:
+              packet.closeArray();
+              break;
+            default:
+              _runs_size = 0;
+              _slots_size = 0;
+              return false;
+          }
+        }
+        packet.closeMessage();
+      }
+      packet.closeBundle();
+      _size = packet.size();
+    }
+    catch (const OSCPP::Error &e) {
+      DEBUG("error building message template %s", e.what());
+      _runs_size = 0;
+      _slots_size = 0;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool isValid() const {
+    return _size > 0;
+  }
+
+  size_t slotsSize() const {
+    return _slots_size;
+  }
+
+  // Writes the packet into buffer, which must hold at least
+  // kMaxTemplateSize bytes. values has one entry per slot.
+  size_t render(void* buffer, uint64_t time, const float* values) const {
+    char* out = static_cast<char*>(buffer);
+    std::memcpy(out, _packet.data(), _size);
+
+    const uint64_t timeN = OSCPP::convert64<OSCPP::NetworkByteOrder>(time);
+    std::memcpy(out + kTimetagOffset, &timeN, 8);
+
+    for (size_t i = 0; i < _runs_size; i++) {
+      const Run& run = _runs[i];
+      OSCPP::convert32Array<OSCPP::NetworkByteOrder>(
+        out + run.offset,
+        values,
+        run.count
+      );
+      values += run.count;
+    }
+    return _size;
+  }
+
+  private:
+  // Consecutive float arguments, including the elements of an array, sit
+  // next to each other in the packet and are converted in one go.
+  struct Run {
+    uint32_t offset;
+    uint32_t count;
+  };
+
+  void addSlot(uint32_t offset) {
+    _slots_size++;
+    if (_runs_size > 0) {
+      Run& last = _runs[_runs_size - 1];
+      if (last.offset + 4 * last.count == offset) {
+        last.count++;
+        return;
+      }
+    }
+    _runs[_runs_size].offset = offset;
+    _runs[_runs_size].count = 1;
+    _runs_size++;
+  }
+
+  // Right after the "#bundle" string.
+  static const size_t kTimetagOffset = 8;
 
-const size_t kMaxPacketSize = 8192;
+  std::array<char, kMaxTemplateSize> _packet;
+  size_t _size;
+  std::array<Run, kMaxTemplateRuns> _runs;
+  size_t _runs_size;
+  size_t _slots_size;
+};
+
+// Drained every millisecond while samples keep coming, this leaves room for
+// a few ms of I/O thread stalls even with a trigger firing at audio rate.
+// After an idle spell the first sample waits up to kIdleDrainInterval.
+const size_t kSampleQueueSize = 256;
+
+// What drain() does when the transport has no free send buffer left.
+// OSC_DROP_OLDEST discards everything queued except the latest sample, so
+// the freshest value goes out once a buffer is released, and counts the
+// discarded samples as dropped. OSC_DROP_NEWEST keeps the backlog in order
+// to send it once buffers come back, and lets the ring reject new samples
+// when it fills up; push() counts those.
+enum OSCOverflowPolicy {
+  OSC_DROP_OLDEST,
+  OSC_DROP_NEWEST
+};
+
+enum OSCProtocol {
+  OSC_UDP,
+  OSC_TCP_SLIP,
+  OSC_TCP_SIZE_PREFIX
+};
+
+const size_t kMaxDestinations = 16;
+
+// Where a sender's packets go. Each packet is encoded once and the same
+// bytes are handed to every destination. Network endpoints may be unicast,
+// multicast or broadcast addresses, IPv4 or IPv6.
+struct OSCDestinations {
+  std::vector<udp::endpoint> endpoints;
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+  std::vector<local_datagram::endpoint> localEndpoints;
+#endif
+
+  bool empty() const {
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    if (!localEndpoints.empty()) return false;
+#endif
+    return endpoints.empty();
+  }
 
-class OSCSender final {
+  size_t size() const {
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    return endpoints.size() + localEndpoints.size();
+#else
+    return endpoints.size();
+#endif
+  }
+};
+
+// Snapshot of a sender's counters since start(). packets and bytes count
+// every datagram or stream write per destination.
+struct OSCSenderCounters {
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t sendErrors;
+  uint64_t dropped;
+  uint64_t encodeErrors;
+  size_t queueHighWater;
+};
+
+// Per-module side of the sender: a ring of samples from the engine thread
+// plus the destinations and the bundle they are encoded into. Encoding and
+// socket I/O run on the shared OSCTransport thread.
+class OSCSender final : public OSCTransport::Client {
   public:
   OSCSender():
-    _io_service(),
     _is_running(false),
-    _socket(_io_service),
-    _endpoint(nonstd::nullopt) {
+    _overflow_policy(OSC_DROP_OLDEST),
+    _dropped(0),
+    _lookahead(0),
+    _latency_avg(0),
+    _latency_max(0),
+    _encode_errors(0),
+    _queue_high_water(0),
+    _send_counters(std::make_shared<OSCSendCounters>()),
+    _is_timing(false),
+    _trace_id(nextTraceId()) {
+    initBundle();
   }
 
   OSCSender(
     udp::endpoint endpoint
   ):
-    _io_service(),
     _is_running(false),
-    _socket(_io_service),
-    _endpoint(endpoint) {
+    _overflow_policy(OSC_DROP_OLDEST),
+    _dropped(0),
+    _lookahead(0),
+    _latency_avg(0),
+    _latency_max(0),
+    _encode_errors(0),
+    _queue_high_water(0),
+    _send_counters(std::make_shared<OSCSendCounters>()),
+    _is_timing(false),
+    _trace_id(nextTraceId()) {
+    _destinations.endpoints.push_back(endpoint);
+    initBundle();
   }
 
   OSCSender(
     const OSCSender& pOther
   ):
-    _io_service(),
     _is_running(false),
-    _socket(_io_service),
-    _endpoint(pOther._endpoint) {
+    _overflow_policy(pOther._overflow_policy.load()),
+    _dropped(0),
+    _lookahead(pOther._lookahead.load()),
+    _latency_avg(0),
+    _latency_max(0),
+    _encode_errors(0),
+    _queue_high_water(0),
+    _send_counters(std::make_shared<OSCSendCounters>()),
+    _is_timing(false),
+    _trace_id(nextTraceId()),
+    _destinations(pOther._destinations),
+    _protocol(pOther._protocol),
+    _bundle(pOther._bundle) {
+    std::copy(pOther._channels, pOther._channels + kMaxInputs, _channels);
   }
 
   ~OSCSender() {
     if (_is_running.load(std::memory_order_relaxed)) stop();
+    OSCTracer::instance().forgetSender(_trace_id);
+  }
+
+  // The protocol setting applies to the network endpoints only, local
+  // destinations always get datagrams.
+  void setDestinations(const OSCDestinations& destinations) {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    _destinations = destinations;
+    _is_connection_dirty = true;
+  }
+
+  void setProtocol(OSCProtocol protocol) {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    _protocol = protocol;
+    _is_connection_dirty = true;
+  }
+
+  void setAddress(const std::string& address) {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    _bundle.messages[0].setAddress(address.c_str());
+    _is_template_dirty = true;
+  }
+
+  // Shown with this sender's events in a trace.
+  void setTraceLabel(const std::string& label) {
+    OSCTracer::instance().nameSender(_trace_id, label);
+  }
+
+  void setOverflowPolicy(OSCOverflowPolicy policy) {
+    _overflow_policy.store(policy, std::memory_order_relaxed);
+  }
+
+  // Samples dropped because the ring was full or the buffer pool ran dry,
+  // plus one for every destination that did not take a packet.
+  uint64_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  // Timetags are moved this far into the future, so receivers can schedule
+  // the values instead of applying them with network jitter included.
+  void setLookahead(float seconds) {
+    _lookahead.store(
+      (uint64_t) (seconds * 4294967296.0),
+      std::memory_order_relaxed
+    );
   }
 
-  void setEndpoint(udp::endpoint endpoint) {
-    _endpoint = endpoint;
+  // Time from push() until the I/O thread handed the sample's packet to
+  // the transport, in microseconds on the steady clock. The average is a
+  // moving one over roughly the last 16 packets.
+  uint32_t latencyAverage() const {
+    return _latency_avg.load(std::memory_order_relaxed);
+  }
+
+  uint32_t latencyMax() const {
+    return _latency_max.load(std::memory_order_relaxed);
+  }
+
+  // Lock-free, any thread.
+  OSCSenderCounters counters() const {
+    OSCSenderCounters counters;
+    counters.packets = _send_counters->packets.load(std::memory_order_relaxed);
+    counters.bytes = _send_counters->bytes.load(std::memory_order_relaxed);
+    counters.sendErrors = _send_counters->errors.load(std::memory_order_relaxed);
+    counters.dropped = _dropped.load(std::memory_order_relaxed);
+    counters.encodeErrors = _encode_errors.load(std::memory_order_relaxed);
+    counters.queueHighWater = _queue_high_water.load(std::memory_order_relaxed);
+    return counters;
+  }
+
+  // Opt-in timing of the hot path: encode, the time a sample waits in the
+  // ring between push() and the I/O thread picking it up, and datagram
+  // sends from hand-off to completion. Enabling starts from empty
+  // histograms.
+  void setTiming(bool isTiming) {
+    if (isTiming && !_is_timing.load(std::memory_order_relaxed)) {
+      _encode_time.clear();
+      _queue_time.clear();
+      _send_counters->sendTime.clear();
+    }
+    _is_timing.store(isTiming, std::memory_order_relaxed);
+  }
+
+  bool isTiming() const {
+    return _is_timing.load(std::memory_order_relaxed);
+  }
+
+  // Any thread. Returns false if the file could not be written.
+  bool writeTiming(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      DEBUG("could not write timing to %s", path.c_str());
+      return false;
+    }
+    _encode_time.write(file, "encode");
+    _queue_time.write(file, "queue");
+    _send_counters->sendTime.write(file, "send");
+    fclose(file);
+    return true;
   }
 
   void start() {
     DEBUG("starting...");
-    assert(!_is_running.exchange(true, std::memory_order_relaxed));
+    assert(!_is_running.load(std::memory_order_relaxed));
+    _transport = OSCTransport::acquire();
+    _transport->attach(this);
+    // push() uses _transport as soon as it sees the sender running.
+    _is_running.store(true, std::memory_order_release);
     DEBUG("started");
-    _socket.open(udp::v4());
-
-    _io_thread = new std::thread([&] () {
-      using work_guard_t = boost::asio::executor_work_guard<
-        boost::asio::io_context::executor_type
-      >;
-      work_guard_t work_guard(_io_service.get_executor());
-      _io_service.run();
-    });
-
-    _watchdog_thread = new std::thread([&] {
-      while (_is_running.load(std::memory_order_relaxed)) {
-      }
-      _io_service.stop();
-    });
   }
 
-  void send(OSCBundle data) {
-    if (!_is_running.load(std::memory_order_relaxed)) return;
+  // Called on the engine thread. Only copies the sample into the ring,
+  // encoding and socket I/O happen in drain() on the I/O thread. Returns
+  // false if the ring is full and the sample was dropped.
+  bool push(const OSCSample& sample) {
+    if (!_is_running.load(std::memory_order_acquire)) return false;
+    if (OSCTracer::isEnabled()) {
+      const uint64_t start = getSteadyTime();
+      const bool isPushed = pushSample(sample);
+      OSCTracer::instance().record(OSC_TRACE_CAPTURE, start, getSteadyTime(), _trace_id);
+      return isPushed;
+    }
+    return pushSample(sample);
+  }
+
+  void stop() {
+    if (!_is_running.exchange(false, std::memory_order_relaxed)) return;
 
-    size_t size = makePacket(&_buffer, kMaxPacketSize, data);
-    // delete[] data.messages;
+    _transport->detach(this);
 
-    if (!_endpoint.has_value()) {
-      return;
+    // Detached, so the I/O thread no longer touches _connections, but the
+    // sockets themselves have to be closed over there.
+    for (std::shared_ptr<OSCStreamConnection>& connection : _connections) {
+      _transport->post([connection] () {
+        connection->close();
+      });
+    }
+    _connections.clear();
+    _is_connection_dirty = true;
+
+    _transport.reset();
+  }
+
+  bool drain(OSCTransport& transport) override {
+    std::lock_guard<std::mutex> lock(_config_mutex);
+    OSCSample sample;
+
+    if (_is_connection_dirty) {
+      updateConnection(transport);
+    }
+
+    const size_t queued = _samples.read_available();
+    if (_destinations.empty()) {
+      while (_samples.pop()) {}
+      return queued > 0;
     }
 
-    _socket.async_send_to(
-      boost::asio::buffer(_buffer, size),
-      _endpoint.value(),
-      0,
-      [=] (
-        boost::system::error_code error,
-        std::size_t bytesTransferred
-      ) {
-        if (!!error.value()) {
-          DEBUG("error sending message %s", error.message().c_str());
+    // The ring only fills up between ticks, so its peak is what is
+    // waiting here.
+    if (queued > _queue_high_water.load(std::memory_order_relaxed)) {
+      _queue_high_water.store(queued, std::memory_order_relaxed);
+    }
+
+    while (_samples.read_available() > 0) {
+      OSCSendBuffer* buffer = transport.checkoutBuffer();
+      if (buffer == nullptr) {
+        onBufferPoolDry();
+        return true;
+      }
+
+      _samples.pop(sample);
+
+      const bool isTiming = _is_timing.load(std::memory_order_relaxed);
+      const bool isTracing = OSCTracer::isEnabled();
+      const uint64_t encodeStart = isTiming || isTracing ? getSteadyTime() : 0;
+      if (isTiming) {
+        _queue_time.record(encodeStart - sample.pushTime);
+      }
+
+      size_t size = encode(sample, buffer);
+      if (size == 0) {
+        transport.releaseBuffer(buffer);
+        continue;
+      }
+
+      uint64_t sendStart = 0;
+      if (isTiming || isTracing) {
+        const uint64_t encodeEnd = getSteadyTime();
+        if (isTracing) {
+          OSCTracer::instance().record(OSC_TRACE_ENCODE, encodeStart, encodeEnd, _trace_id);
+        }
+        if (isTiming) {
+          _encode_time.record(encodeEnd - encodeStart);
+          sendStart = encodeEnd;
         }
       }
-    );
+      send(transport, buffer, size, sendStart);
+      recordLatency(sample.pushTime);
+    }
+
+    // Stream backlogs are written from their own completion handlers.
+    for (std::shared_ptr<OSCStreamConnection>& connection : _connections) {
+      connection->flush();
+    }
+    return queued > 0;
   }
 
-  void stop() {
-    if (_is_running.exchange(false, std::memory_order_relaxed)) return;
+  private:
+  static uint32_t nextTraceId() {
+    static std::atomic<uint32_t> next(0);
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool pushSample(const OSCSample& sample) {
+    OSCSample stamped = sample;
+    stamped.pushTime = getSteadyTime();
+    if (!_samples.push(stamped)) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
 
-    if (_io_thread != nullptr && _io_thread->joinable()) {
-      _io_thread->join();
-      delete _io_thread;
-      _io_thread = nullptr;
+  // Hands one encoded packet to every destination. Stream and local sends
+  // copy the bytes right away, datagrams keep the buffer until they are
+  // on the wire. Streams count their packets once written.
+  void send(
+    OSCTransport& transport,
+    OSCSendBuffer* buffer,
+    size_t size,
+    uint64_t startTime
+  ) {
+    for (std::shared_ptr<OSCStreamConnection>& connection : _connections) {
+      if (!connection->enqueue(buffer->data.data(), size)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+      }
     }
 
-    if (_watchdog_thread != nullptr && _watchdog_thread->joinable()) {
-      _watchdog_thread->join();
-      delete _watchdog_thread;
-      _watchdog_thread = nullptr;
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    for (const local_datagram::endpoint& endpoint : _destinations.localEndpoints) {
+      if (!transport.sendLocalPacket(buffer, size, endpoint)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      _send_counters->add(size);
     }
+#endif
 
-    if (_socket.is_open()) {
-      _socket.close();
+    if (_protocol == OSC_UDP) {
+      transport.sendPacket(
+        buffer,
+        size,
+        _destinations.endpoints,
+        _send_counters,
+        startTime
+      );
+    }
+    else {
+      transport.releaseBuffer(buffer);
     }
   }
 
-  private:
-  boost::asio::io_service _io_service;
+  // I/O thread. Replaces the TCP connections after the destinations or
+  // the protocol changed.
+  void updateConnection(OSCTransport& transport) {
+    _is_connection_dirty = false;
+
+    for (std::shared_ptr<OSCStreamConnection>& connection : _connections) {
+      connection->close();
+    }
+    _connections.clear();
+
+    if (_protocol == OSC_UDP) return;
+
+    for (const udp::endpoint& endpoint : _destinations.endpoints) {
+      std::shared_ptr<OSCStreamConnection> connection =
+        std::make_shared<OSCStreamConnection>(
+          transport.ioContext(),
+          tcp::endpoint(endpoint.address(), endpoint.port()),
+          _protocol == OSC_TCP_SLIP
+            ? OSCStreamConnection::SLIP
+            : OSCStreamConnection::SIZE_PREFIX,
+          _send_counters
+        );
+      connection->open();
+      _connections.push_back(connection);
+    }
+  }
+
+  void recordLatency(uint64_t pushTime) {
+    const uint64_t now = getSteadyTime();
+    const uint32_t latency =
+      now > pushTime ? (uint32_t) std::min<uint64_t>(
+        (now - pushTime) / 1000,
+        UINT32_MAX
+      ) : 0;
+
+    _latency_avg_state += ((int64_t) latency - _latency_avg_state) / 16;
+    _latency_avg.store((uint32_t) _latency_avg_state, std::memory_order_relaxed);
+    if (latency > _latency_max.load(std::memory_order_relaxed)) {
+      _latency_max.store(latency, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns the packet size, or 0 if the sample could not be encoded.
+  size_t encode(const OSCSample& sample, OSCSendBuffer* buffer) {
+    const uint64_t time =
+      sample.time + _lookahead.load(std::memory_order_relaxed);
+
+    if (
+      sample.channels[0] != _channels[0] ||
+      sample.channels[1] != _channels[1]
+    ) {
+      setLayout(sample.channels);
+    }
+
+    if (_is_template_dirty) {
+      _template.build(_bundle);
+      _is_template_dirty = false;
+    }
+
+    if (_template.isValid()) {
+      return _template.render(
+        buffer->data.data(),
+        time,
+        sample.values
+      );
+    }
+
+    OSCMessage& msg = _bundle.messages[0];
+    size_t k = 0;
+    for (size_t j = 0; j < msg.valuesSize; j++) {
+      if (msg.values[j].type == OSCMessageValue::FLOAT) {
+        msg.values[j].f = sample.values[k++];
+      }
+    }
+    _bundle.time = time;
+
+    try {
+      return makePacket(buffer->data.data(), kMaxPacketSize, _bundle);
+    }
+    catch (const OSCPP::Error &e) {
+      // Overflow or underrun of the packet buffer.
+      _encode_errors.fetch_add(1, std::memory_order_relaxed);
+      DEBUG("error encoding message %s", e.what());
+      return 0;
+    }
+  }
+
+  void onBufferPoolDry() {
+    if (_overflow_policy.load(std::memory_order_relaxed) != OSC_DROP_OLDEST) {
+      return;
+    }
+
+    size_t stale = _samples.read_available();
+    if (stale <= 1) return;
+    stale -= 1;
+    for (size_t i = 0; i < stale; i++) {
+      _samples.pop();
+    }
+    _dropped.fetch_add(stale, std::memory_order_relaxed);
+  }
+
+  void initBundle() {
+    const uint8_t mono[kMaxInputs] = {1, 1};
+    _bundle.messagesSize = 1;
+    _bundle.messages[0].setAddress("");
+    setLayout(mono);
+  }
+
+  // Mono inputs go out as plain floats (",ff"). As soon as one input is
+  // polyphonic every input becomes an array (",[ff..][ff..]"), so a
+  // receiver can tell the inputs apart by the type tags alone.
+  void setLayout(const uint8_t* channels) {
+    OSCMessage& msg = _bundle.messages[0];
+    bool isPoly = false;
+    for (size_t i = 0; i < kMaxInputs; i++) {
+      _channels[i] = channels[i];
+      isPoly = isPoly || channels[i] > 1;
+    }
+
+    size_t j = 0;
+    for (size_t i = 0; i < kMaxInputs; i++) {
+      if (isPoly) msg.values[j++].type = OSCMessageValue::ARRAY_BEGIN;
+      for (size_t c = 0; c < channels[i]; c++) {
+        msg.values[j++].type = OSCMessageValue::FLOAT;
+      }
+      if (isPoly) msg.values[j++].type = OSCMessageValue::ARRAY_END;
+    }
+    msg.valuesSize = j;
+    _is_template_dirty = true;
+  }
+
+  std::shared_ptr<OSCTransport> _transport;
   std::atomic<bool> _is_running;
-  std::thread* _io_thread = nullptr;
-  std::thread* _watchdog_thread = nullptr;
-  udp::socket _socket;
-  nonstd::optional<udp::endpoint> _endpoint;
-  std::array<char, kMaxPacketSize> _buffer;
+  std::atomic<OSCOverflowPolicy> _overflow_policy;
+  std::atomic<uint64_t> _dropped;
+  std::atomic<uint64_t> _lookahead;
+  std::atomic<uint32_t> _latency_avg;
+  std::atomic<uint32_t> _latency_max;
+  std::atomic<uint64_t> _encode_errors;
+  std::atomic<size_t> _queue_high_water;
+  // Shared with in-flight sends, which may complete after stop().
+  std::shared_ptr<OSCSendCounters> _send_counters;
+  std::atomic<bool> _is_timing;
+  OSCHistogram _encode_time;
+  OSCHistogram _queue_time;
+  // Tells senders apart in a trace.
+  uint32_t _trace_id;
+  int64_t _latency_avg_state = 0;
+  boost::lockfree::spsc_queue<
+    OSCSample,
+    boost::lockfree::capacity<kSampleQueueSize>
+  > _samples;
+  std::mutex _config_mutex;
+  OSCDestinations _destinations;
+  OSCProtocol _protocol = OSC_UDP;
+  std::vector<std::shared_ptr<OSCStreamConnection>> _connections;
+  bool _is_connection_dirty = true;
+  OSCBundle _bundle;
+  uint8_t _channels[kMaxInputs];
+  OSCMessageTemplate _template;
+  bool _is_template_dirty = true;
 };
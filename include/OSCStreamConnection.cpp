@@ -0,0 +1,211 @@
+#pragma once
+#include "OSCLog.cpp"
+#include "OSCTransport.cpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <oscpp/detail/host.hpp>
+
+using boost::asio::ip::tcp;
+
+const size_t kMaxStreamBacklog = 64 * 1024;
+const std::chrono::seconds kStreamReconnectDelay(1);
+
+const char kSlipEnd = '\xC0';
+const char kSlipEsc = '\xDB';
+const char kSlipEscEnd = '\xDC';
+const char kSlipEscEsc = '\xDD';
+
+// A TCP connection carrying framed OSC packets. Packets enqueued during a
+// drain tick are coalesced into a single write, and packets arriving while
+// a write is in flight queue behind it up to kMaxStreamBacklog bytes. Nagle
+// is off, so the batching here is the only one and latency stays bounded
+// by the drain interval plus one round of writes.
+//
+// After an error the connection is retried every kStreamReconnectDelay.
+// Packets enqueued while disconnected are dropped, stale control values
+// are of no use to the receiver. All methods run on the I/O thread.
+//
+// Packets count as sent once their write completed, and as errors when
+// the write failed or the connection went down before writing them.
+class OSCStreamConnection final :
+  public std::enable_shared_from_this<OSCStreamConnection> {
+  public:
+  enum Framing {
+    // OSC 1.1: every packet wrapped in double-ended SLIP (RFC 1055).
+    SLIP,
+    // OSC 1.0: every packet preceded by its size as a big-endian int32.
+    SIZE_PREFIX
+  };
+
+  OSCStreamConnection(
+    boost::asio::io_context& io,
+    tcp::endpoint endpoint,
+    Framing framing,
+    std::shared_ptr<OSCSendCounters> counters
+  ):
+    _socket(io),
+    _reconnect_timer(io),
+    _endpoint(endpoint),
+    _framing(framing),
+    _counters(counters),
+    _state(DISCONNECTED),
+    _is_writing(false) {
+    _pending.reserve(kMaxStreamBacklog);
+    _writing.reserve(kMaxStreamBacklog);
+  }
+
+  OSCStreamConnection(const OSCStreamConnection&) = delete;
+  OSCStreamConnection& operator=(const OSCStreamConnection&) = delete;
+
+  void open() {
+    connect();
+  }
+
+  void close() {
+    _state = CLOSED;
+    _reconnect_timer.cancel();
+    boost::system::error_code ignored;
+    _socket.close(ignored);
+  }
+
+  bool isConnected() const {
+    return _state == CONNECTED;
+  }
+
+  // Frames the packet into the pending write. Returns false if the packet
+  // was dropped because the connection is down or the backlog is full.
+  bool enqueue(const char* data, size_t size) {
+    if (_state != CONNECTED) return false;
+
+    const size_t framedSize = _framing == SLIP ? 2 * size + 2 : size + 4;
+    if (_pending.size() + framedSize > kMaxStreamBacklog) return false;
+
+    if (_framing == SLIP) {
+      appendSlip(data, size);
+    }
+    else {
+      const uint32_t sizeN =
+        OSCPP::convert32<OSCPP::NetworkByteOrder>((uint32_t) size);
+      const char* sizeBytes = reinterpret_cast<const char*>(&sizeN);
+      _pending.insert(_pending.end(), sizeBytes, sizeBytes + 4);
+      _pending.insert(_pending.end(), data, data + size);
+    }
+    _pending_packets++;
+    _pending_bytes += size;
+    return true;
+  }
+
+  // Starts writing everything enqueued so far, unless a write is already
+  // in flight; its completion picks up whatever queued up in the meantime.
+  void flush() {
+    if (_state != CONNECTED || _is_writing || _pending.empty()) return;
+
+    _writing.swap(_pending);
+    _pending.clear();
+    _writing_packets = _pending_packets;
+    _writing_bytes = _pending_bytes;
+    _pending_packets = 0;
+    _pending_bytes = 0;
+    _is_writing = true;
+
+    std::shared_ptr<OSCStreamConnection> self = shared_from_this();
+    boost::asio::async_write(
+      _socket,
+      boost::asio::buffer(_writing),
+      [self] (boost::system::error_code error, std::size_t bytesWritten) {
+        self->_is_writing = false;
+        self->_writing.clear();
+        if (error) {
+          self->_counters->fail(self->_writing_packets);
+          self->onError(error);
+          return;
+        }
+        self->_counters->addPackets(self->_writing_packets, self->_writing_bytes);
+        self->flush();
+      }
+    );
+  }
+
+  private:
+  enum State {
+    DISCONNECTED,
+    CONNECTING,
+    CONNECTED,
+    CLOSED
+  };
+
+  void connect() {
+    _state = CONNECTING;
+
+    std::shared_ptr<OSCStreamConnection> self = shared_from_this();
+    _socket.async_connect(_endpoint, [self] (boost::system::error_code error) {
+      if (self->_state == CLOSED) return;
+      if (error) {
+        self->onError(error);
+        return;
+      }
+
+      boost::system::error_code ignored;
+      self->_socket.set_option(tcp::no_delay(true), ignored);
+      self->_state = CONNECTED;
+      DEBUG("stream connected");
+    });
+  }
+
+  void onError(boost::system::error_code error) {
+    if (_state == CLOSED) return;
+    DEBUG("stream connection error %s", error.message().c_str());
+
+    _state = DISCONNECTED;
+    _pending.clear();
+    _counters->fail(_pending_packets);
+    _pending_packets = 0;
+    _pending_bytes = 0;
+    boost::system::error_code ignored;
+    _socket.close(ignored);
+
+    std::shared_ptr<OSCStreamConnection> self = shared_from_this();
+    _reconnect_timer.expires_after(kStreamReconnectDelay);
+    _reconnect_timer.async_wait([self] (boost::system::error_code error) {
+      if (error || self->_state == CLOSED) return;
+      self->connect();
+    });
+  }
+
+  void appendSlip(const char* data, size_t size) {
+    _pending.push_back(kSlipEnd);
+    for (size_t i = 0; i < size; i++) {
+      const char c = data[i];
+      if (c == kSlipEnd) {
+        _pending.push_back(kSlipEsc);
+        _pending.push_back(kSlipEscEnd);
+      }
+      else if (c == kSlipEsc) {
+        _pending.push_back(kSlipEsc);
+        _pending.push_back(kSlipEscEsc);
+      }
+      else {
+        _pending.push_back(c);
+      }
+    }
+    _pending.push_back(kSlipEnd);
+  }
+
+  tcp::socket _socket;
+  boost::asio::steady_timer _reconnect_timer;
+  tcp::endpoint _endpoint;
+  Framing _framing;
+  std::shared_ptr<OSCSendCounters> _counters;
+  State _state;
+  bool _is_writing;
+  std::vector<char> _pending;
+  std::vector<char> _writing;
+  // Packets framed into each buffer and their unframed size.
+  size_t _pending_packets = 0;
+  size_t _pending_bytes = 0;
+  size_t _writing_packets = 0;
+  size_t _writing_bytes = 0;
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "OSCLog.cpp"
+#include "OSCHistogram.cpp"
+
+// Power of two, about 2.5 MB once tracing was enabled.
+const size_t kTraceEvents = 1 << 16;
+// Rows in the trace, one per thread. Threads beyond these share one more
+// row.
+const size_t kMaxTraceThreads = 64;
+
+enum OSCTraceEventType : uint32_t {
+  // push() on the engine thread, arg is the sender.
+  OSC_TRACE_CAPTURE,
+  // One sample encoded on the I/O thread, arg is the sender.
+  OSC_TRACE_ENCODE,
+  // A drain tick of the I/O thread, arg is how late the timer fired in ns.
+  OSC_TRACE_DRAIN,
+  // One sendmmsg() call, arg is the number of datagrams.
+  OSC_TRACE_SEND,
+  // Completion of an async_send_to(), arg is the number of bytes.
+  OSC_TRACE_SEND_COMPLETE,
+  OSC_TRACE_EVENT_TYPES
+};
+
+const char* const kTraceEventNames[OSC_TRACE_EVENT_TYPES] = {
+  "capture", "encode", "drain", "send", "send complete"
+};
+const char* const kTraceArgNames[OSC_TRACE_EVENT_TYPES] = {
+  "sender", "sender", "late_ns", "datagrams", "bytes"
+};
+
+// Plugin-wide event tracer. Every sender, the shared I/O thread and the
+// engine threads write into one ring of the last kTraceEvents events,
+// which can be written out as Chrome trace event JSON and opened in
+// chrome://tracing or Perfetto to see contention and batching. Every OS
+// thread gets a row of its own, the sender an event belongs to is in its
+// args.
+//
+// Recording is lock-free and never allocates: a slot is claimed with one
+// fetch_add and guarded by a sequence number, so writeChromeTrace() skips
+// slots that are being overwritten instead of blocking the writers. When
+// disabled, recording costs one relaxed load.
+class OSCTracer {
+  public:
+  static OSCTracer& instance() {
+    static OSCTracer tracer;
+    return tracer;
+  }
+
+  static bool isEnabled() {
+    return instance()._is_enabled.load(std::memory_order_relaxed);
+  }
+
+  // The ring is allocated on first use and kept, a late writer may still
+  // be recording after tracing was disabled.
+  void setEnabled(bool isEnabled) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (isEnabled && !_slots) {
+      _slots.reset(new Slot[kTraceEvents]);
+    }
+    _is_enabled.store(isEnabled, std::memory_order_release);
+  }
+
+  // Labels the calling thread's row, other rows show as "thread <n>".
+  void nameThread(const std::string& name) {
+    const uint32_t thread = currentThread();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _thread_names[thread] = name;
+  }
+
+  // Labels the events whose arg is this sender, e.g. with its module id.
+  void nameSender(uint64_t sender, const std::string& name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sender_names[sender] = name;
+  }
+
+  void forgetSender(uint64_t sender) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sender_names.erase(sender);
+  }
+
+  // Records on the calling thread's row. start and end are getSteadyTime()
+  // values. Equal ones make an instant event.
+  void record(OSCTraceEventType type, uint64_t start, uint64_t end, uint64_t arg) {
+    if (!_is_enabled.load(std::memory_order_acquire)) return;
+
+    const uint32_t thread = currentThread();
+    const uint64_t index = _next.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[index & (kTraceEvents - 1)];
+    // Odd while writing, so readers can tell a torn slot.
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(end - start, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.typeAndThread.store(
+      ((uint64_t) type << 32) | thread,
+      std::memory_order_relaxed
+    );
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+  }
+
+  // Any thread, recording carries on meanwhile. Returns false if the file
+  // could not be written.
+  bool writeChromeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      DEBUG("could not write trace to %s", path.c_str());
+      return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool isFirst = true;
+    // The last row only fills up once every other one is taken.
+    bool isFull = true;
+    for (size_t thread = 0; thread <= kMaxTraceThreads; thread++) {
+      std::string name = _thread_names[thread];
+      if (thread == kMaxTraceThreads) {
+        if (!isFull) continue;
+        if (name.empty()) name = "other threads";
+      }
+      else if (_thread_keys[thread].load(std::memory_order_relaxed) == 0) {
+        isFull = false;
+        continue;
+      }
+      else if (name.empty()) {
+        name = "thread " + std::to_string(thread);
+      }
+      fprintf(
+        file,
+        "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+        isFirst ? "" : ",\n",
+        thread,
+        name.c_str()
+      );
+      isFirst = false;
+    }
+
+    const uint64_t end = _slots ? _next.load(std::memory_order_acquire) : 0;
+    const uint64_t begin = end > kTraceEvents ? end - kTraceEvents : 0;
+    for (uint64_t index = begin; index < end; index++) {
+      const Slot& slot = _slots[index & (kTraceEvents - 1)];
+      const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence != 2 * index + 2) continue;
+
+      const uint64_t start = slot.start.load(std::memory_order_relaxed);
+      const uint64_t duration = slot.duration.load(std::memory_order_relaxed);
+      const uint64_t arg = slot.arg.load(std::memory_order_relaxed);
+      const uint64_t typeAndThread = slot.typeAndThread.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+
+      const uint32_t type = (uint32_t) (typeAndThread >> 32);
+      if (type >= OSC_TRACE_EVENT_TYPES) continue;
+
+      // Chrome wants microseconds, the fraction keeps the nanoseconds.
+      fprintf(
+        file,
+        "%s{\"name\":\"%s\",\"cat\":\"osc\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,",
+        isFirst ? "" : ",\n",
+        kTraceEventNames[type],
+        (uint32_t) typeAndThread,
+        start / 1000.
+      );
+      if (duration == 0) {
+        fprintf(file, "\"ph\":\"i\",\"s\":\"t\",");
+      }
+      else {
+        fprintf(file, "\"ph\":\"X\",\"dur\":%.3f,", duration / 1000.);
+      }
+      fprintf(
+        file,
+        "\"args\":{\"%s\":%llu",
+        kTraceArgNames[type],
+        (unsigned long long) arg
+      );
+      if (type == OSC_TRACE_CAPTURE || type == OSC_TRACE_ENCODE) {
+        std::map<uint64_t, std::string>::const_iterator name = _sender_names.find(arg);
+        if (name != _sender_names.end()) {
+          fprintf(file, ",\"module\":\"%s\"", name->second.c_str());
+        }
+      }
+      fprintf(file, "}}");
+      isFirst = false;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+  }
+
+  private:
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> duration{0};
+    std::atomic<uint64_t> arg{0};
+    std::atomic<uint64_t> typeAndThread{0};
+  };
+
+  OSCTracer(): _is_enabled(false), _next(0) {
+    for (std::atomic<size_t>& key : _thread_keys) key.store(0);
+  }
+
+  // The row of the calling thread. Its std::thread::id is hashed into an
+  // open addressed table that rows are claimed from with a CAS, so this
+  // never allocates and needs no thread_local storage, which a plugin
+  // loaded with dlopen() may only set up on first use. Rows stay claimed,
+  // a thread that comes back with the same id finds its old row.
+  uint32_t currentThread() {
+    // Never 0, which marks a free row.
+    const size_t key = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    for (size_t probe = 0; probe < kMaxTraceThreads; probe++) {
+      const size_t row = (key + probe) % kMaxTraceThreads;
+      size_t found = _thread_keys[row].load(std::memory_order_relaxed);
+      if (found == 0) {
+        if (_thread_keys[row].compare_exchange_strong(found, key, std::memory_order_relaxed)) {
+          return (uint32_t) row;
+        }
+      }
+      if (found == key) return (uint32_t) row;
+    }
+    return kMaxTraceThreads;
+  }
+
+  std::atomic<bool> _is_enabled;
+  std::atomic<uint64_t> _next;
+  std::unique_ptr<Slot[]> _slots;
+  std::atomic<size_t> _thread_keys[kMaxTraceThreads];
+  std::mutex _mutex;
+  std::string _thread_names[kMaxTraceThreads + 1];
+  std::map<uint64_t, std::string> _sender_names;
+};
@@ -0,0 +1,485 @@
+#pragma once
+#include "OSCLog.cpp"
+#include "OSCHistogram.cpp"
+#include "OSCSample.cpp"
+#include "OSCTrace.cpp"
+#include <atomic>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <cerrno>
+#define OSC_USE_SENDMMSG 1
+#endif
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define OSC_HAS_LOCAL_SOCKETS 1
+using local_datagram = boost::asio::local::datagram_protocol;
+#endif
+
+using boost::asio::ip::udp;
+
+const size_t kSendBufferCount = 64;
+const std::chrono::milliseconds kDrainInterval(1);
+// Once this many ticks in a row found nothing queued the timer slows down
+// to kIdleDrainInterval, until a tick finds work again.
+const size_t kIdleDrainTicks = 100;
+const std::chrono::milliseconds kIdleDrainInterval(20);
+
+// Encode target for one outgoing datagram. A buffer is checked out of the
+// transport pool per packet and stays owned by the socket until the sends
+// to every destination completed.
+struct OSCSendBuffer {
+  std::array<char, kMaxPacketSize> data;
+  size_t pendingSends;
+};
+
+// What became of the datagrams a client handed to sendPacket(), one count
+// per destination. Written on the I/O thread, readable from any thread.
+struct OSCSendCounters {
+  std::atomic<uint64_t> packets{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> errors{0};
+  // From sendPacket() to the datagram being on the wire, for the sends
+  // that passed a start time.
+  OSCHistogram sendTime;
+
+  void add(size_t size, uint64_t startTime = 0) {
+    packets.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    if (startTime != 0) sendTime.record(getSteadyTime() - startTime);
+  }
+
+  // For stream writes, which carry several packets at once.
+  void addPackets(size_t count, size_t size) {
+    packets.fetch_add(count, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+
+  void fail(size_t count = 1) {
+    errors.fetch_add(count, std::memory_order_relaxed);
+  }
+};
+
+// One I/O thread and one socket shared by every sender in the plugin.
+// Senders attach themselves and get drained on every tick of a single
+// timer, so the number of threads and sockets does not grow with the
+// number of modules in the patch. While nothing is queued the timer backs
+// off to kIdleDrainInterval, so clients never have to signal the I/O
+// thread and queueing stays a plain store on their side.
+class OSCTransport final {
+  public:
+  class Client {
+    public:
+    virtual ~Client() {}
+
+    // Called on the I/O thread with the client list locked. Returns true if
+    // it found anything queued.
+    virtual bool drain(OSCTransport& transport) = 0;
+  };
+
+  OSCTransport():
+    _io_service(),
+    _work_guard(_io_service.get_executor()),
+    _socket(_io_service),
+    _socket_v6(_io_service),
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    _local_socket(_io_service),
+#endif
+    _drain_timer(_io_service),
+    _buffers(kSendBufferCount) {
+    DEBUG("starting transport...");
+    _free_buffers.reserve(kSendBufferCount);
+    for (OSCSendBuffer& buffer : _buffers) {
+      _free_buffers.push_back(&buffer);
+    }
+    _socket.open(udp::v4());
+    _socket.set_option(udp::socket::broadcast(true));
+    // IPv6 destinations get a socket of their own, as long as the host
+    // has an IPv6 stack at all.
+    boost::system::error_code error;
+    _socket_v6.open(udp::v6(), error);
+    if (error) {
+      DEBUG("no IPv6 socket %s", error.message().c_str());
+    }
+#if defined(OSC_USE_SENDMMSG)
+    _socket.non_blocking(true);
+    if (_socket_v6.is_open()) {
+      _socket_v6.non_blocking(true);
+    }
+    _batch.reserve(kSendBufferCount);
+    _headers.resize(kSendBufferCount);
+    _iovecs.resize(kSendBufferCount);
+    _header_packets.resize(kSendBufferCount);
+#endif
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    _local_socket.open();
+    _local_socket.non_blocking(true);
+#endif
+    scheduleDrain();
+
+    _io_thread = std::thread([this] () {
+      OSCTracer::instance().nameThread("OSC I/O");
+      _io_service.run();
+    });
+    DEBUG("transport started");
+  }
+
+  OSCTransport(const OSCTransport&) = delete;
+  OSCTransport& operator=(const OSCTransport&) = delete;
+
+  ~OSCTransport() {
+    boost::asio::post(_io_service, [this] () {
+      // The timer may already have fired with its handler queued, in which
+      // case cancel() is a no-op and only the flag stops the rescheduling.
+      _is_stopping = true;
+      _drain_timer.cancel();
+      _work_guard.reset();
+    });
+
+    if (_io_thread.joinable()) {
+      _io_thread.join();
+    }
+
+    if (_socket.is_open()) {
+      _socket.close();
+    }
+    if (_socket_v6.is_open()) {
+      _socket_v6.close();
+    }
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+    if (_local_socket.is_open()) {
+      _local_socket.close();
+    }
+#endif
+    DEBUG("transport stopped");
+  }
+
+  // Returns the plugin-wide transport, creating it on first use. It is
+  // torn down when the last holder releases it.
+  static std::shared_ptr<OSCTransport> acquire() {
+    static std::mutex mutex;
+    static std::weak_ptr<OSCTransport> instance;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<OSCTransport> transport = instance.lock();
+    if (!transport) {
+      transport = std::make_shared<OSCTransport>();
+      instance = transport;
+    }
+    return transport;
+  }
+
+  void attach(Client* client) {
+    std::lock_guard<std::mutex> lock(_clients_mutex);
+    _clients.push_back(client);
+  }
+
+  // Once this returns the client is no longer touched by the I/O thread.
+  void detach(Client* client) {
+    std::lock_guard<std::mutex> lock(_clients_mutex);
+    _clients.erase(
+      std::remove(_clients.begin(), _clients.end(), client),
+      _clients.end()
+    );
+  }
+
+  boost::asio::io_context& ioContext() {
+    return _io_service;
+  }
+
+  // Runs handler on the I/O thread.
+  template <typename Handler>
+  void post(Handler handler) {
+    boost::asio::post(_io_service, handler);
+  }
+
+  // I/O thread only. Clients check out a buffer per packet, encode into
+  // it and hand it to sendPacket(), which returns it to the pool once the
+  // datagram is on the wire for every destination. Returns nullptr when
+  // every buffer is in flight.
+  //
+  // On Linux packets are collected for the whole drain tick and go out in
+  // one sendmmsg() call per address family from flush(), elsewhere each
+  // destination is an async_send_to().
+  OSCSendBuffer* checkoutBuffer() {
+#if defined(OSC_USE_SENDMMSG)
+    // Batched buffers are only held until the next flush.
+    if (_free_buffers.empty()) flush();
+#endif
+    if (_free_buffers.empty()) return nullptr;
+    OSCSendBuffer* buffer = _free_buffers.back();
+    _free_buffers.pop_back();
+    return buffer;
+  }
+
+  void releaseBuffer(OSCSendBuffer* buffer) {
+    _free_buffers.push_back(buffer);
+  }
+
+  // The same encoded buffer goes out to each endpoint, unicast, multicast
+  // and broadcast alike; the transport takes ownership of it. counters is
+  // updated as the sends complete, which may be after the client detached.
+  // A non-zero startTime, from getSteadyTime(), also times the sends.
+  void sendPacket(
+    OSCSendBuffer* buffer,
+    size_t size,
+    const std::vector<udp::endpoint>& endpoints,
+    const std::shared_ptr<OSCSendCounters>& counters,
+    uint64_t startTime = 0
+  ) {
+    buffer->pendingSends = endpoints.size();
+    if (buffer->pendingSends == 0) {
+      releaseBuffer(buffer);
+      return;
+    }
+
+    for (const udp::endpoint& endpoint : endpoints) {
+#if defined(OSC_USE_SENDMMSG)
+      // Batches are flushed before drain() returns, the client is still
+      // attached by then.
+      PendingPacket packet = {buffer, size, endpoint, counters.get(), startTime};
+      _batch.push_back(packet);
+#else
+      udp::socket& socket = socketFor(endpoint);
+      if (!socket.is_open()) {
+        counters->fail();
+        completeSend(buffer);
+        continue;
+      }
+      socket.async_send_to(
+        boost::asio::buffer(buffer->data, size),
+        endpoint,
+        0,
+        [this, buffer, counters, startTime] (
+          boost::system::error_code error,
+          std::size_t bytesTransferred
+        ) {
+          completeSend(buffer);
+          if (OSCTracer::isEnabled()) {
+            const uint64_t now = getSteadyTime();
+            OSCTracer::instance().record(OSC_TRACE_SEND_COMPLETE, now, now, bytesTransferred);
+          }
+          if (!!error.value()) {
+            counters->fail();
+            DEBUG("error sending message %s", error.message().c_str());
+            return;
+          }
+          counters->add(bytesTransferred, startTime);
+        }
+      );
+#endif
+    }
+  }
+
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+  // Same-host delivery over an AF_UNIX datagram socket. The kernel copies
+  // the packet straight into the receiver's queue, so the send completes
+  // before this returns and the caller keeps the buffer. Returns false if
+  // the packet was not delivered, e.g. because nobody is bound to the path
+  // or the receiver's queue is full.
+  bool sendLocalPacket(
+    OSCSendBuffer* buffer,
+    size_t size,
+    const local_datagram::endpoint& endpoint
+  ) {
+    boost::system::error_code error;
+    _local_socket.send_to(
+      boost::asio::buffer(buffer->data, size),
+      endpoint,
+      0,
+      error
+    );
+    if (!!error.value()) {
+      // A full receiver queue is plain overload, not worth a log line.
+      if (error != boost::asio::error::would_block) {
+        DEBUG("error sending local message %s", error.message().c_str());
+      }
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  private:
+  udp::socket& socketFor(const udp::endpoint& endpoint) {
+    return endpoint.address().is_v6() ? _socket_v6 : _socket;
+  }
+
+  void completeSend(OSCSendBuffer* buffer) {
+    if (--buffer->pendingSends == 0) {
+      releaseBuffer(buffer);
+    }
+  }
+
+  void scheduleDrain() {
+    _drain_timer.expires_after(
+      _idle_ticks < kIdleDrainTicks ? kDrainInterval : kIdleDrainInterval
+    );
+    _drain_timer.async_wait([this] (boost::system::error_code error) {
+      if (error || _is_stopping) return;
+      if (drain()) {
+        _idle_ticks = 0;
+      }
+      else if (_idle_ticks < kIdleDrainTicks) {
+        _idle_ticks++;
+      }
+      scheduleDrain();
+    });
+  }
+
+  // Returns true if any client found work queued.
+  bool drain() {
+    const bool isTracing = OSCTracer::isEnabled();
+    const uint64_t start = isTracing ? getSteadyTime() : 0;
+    bool isBusy = false;
+
+    {
+      std::lock_guard<std::mutex> lock(_clients_mutex);
+      for (Client* client : _clients) {
+        isBusy = client->drain(*this) || isBusy;
+      }
+      flush();
+    }
+
+    if (isTracing) {
+      const uint64_t expiry = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        _drain_timer.expiry().time_since_epoch()
+      ).count();
+      OSCTracer::instance().record(
+        OSC_TRACE_DRAIN,
+        start,
+        getSteadyTime(),
+        start > expiry ? start - expiry : 0
+      );
+    }
+    return isBusy;
+  }
+
+#if defined(OSC_USE_SENDMMSG)
+  struct PendingPacket {
+    OSCSendBuffer* buffer;
+    size_t size;
+    udp::endpoint endpoint;
+    OSCSendCounters* counters;
+    uint64_t startTime;
+  };
+
+  void flush() {
+    if (_batch.empty()) return;
+
+    flush(_socket, false);
+    flush(_socket_v6, true);
+
+    for (PendingPacket& packet : _batch) {
+      completeSend(packet.buffer);
+    }
+    _batch.clear();
+  }
+
+  // Sends the batched datagrams of one address family in a single call.
+  void flush(udp::socket& socket, bool isV6) {
+    size_t count = 0;
+    for (PendingPacket& packet : _batch) {
+      if (packet.endpoint.address().is_v6() != isV6) continue;
+
+      if (count == _headers.size()) {
+        _headers.resize(2 * count);
+        _iovecs.resize(2 * count);
+        _header_packets.resize(2 * count);
+      }
+      _header_packets[count] = &packet;
+      _iovecs[count].iov_base = packet.buffer->data.data();
+      _iovecs[count].iov_len = packet.size;
+
+      msghdr& header = _headers[count].msg_hdr;
+      std::memset(&header, 0, sizeof(header));
+      header.msg_name = packet.endpoint.data();
+      header.msg_namelen = packet.endpoint.size();
+      header.msg_iovlen = 1;
+      count++;
+    }
+    if (count == 0) return;
+    if (!socket.is_open()) {
+      for (size_t i = 0; i < count; i++) _header_packets[i]->counters->fail();
+      return;
+    }
+
+    // The iovecs may move while growing, so they are only linked once the
+    // batch is complete.
+    for (size_t i = 0; i < count; i++) {
+      _headers[i].msg_hdr.msg_iov = &_iovecs[i];
+    }
+
+    int fd = socket.native_handle();
+    size_t sent = 0;
+    while (sent < count) {
+      const uint64_t start = OSCTracer::isEnabled() ? getSteadyTime() : 0;
+      int result = ::sendmmsg(fd, &_headers[sent], count - sent, 0);
+      if (start != 0) {
+        OSCTracer::instance().record(
+          OSC_TRACE_SEND,
+          start,
+          getSteadyTime(),
+          result > 0 ? (uint64_t) result : 0
+        );
+      }
+      if (result >= 0) {
+        for (int i = 0; i < result; i++, sent++) {
+          PendingPacket* packet = _header_packets[sent];
+          packet->counters->add(packet->size, packet->startTime);
+        }
+        continue;
+      }
+      if (errno == EINTR) continue;
+
+      DEBUG("error sending message %s", std::strerror(errno));
+      // A full socket buffer fails the rest of the batch as well, anything
+      // else is specific to the datagram at the head.
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        for (; sent < count; sent++) _header_packets[sent]->counters->fail();
+        break;
+      }
+      _header_packets[sent]->counters->fail();
+      sent++;
+    }
+  }
+#else
+  void flush() {}
+#endif
+
+  using work_guard_t = boost::asio::executor_work_guard<
+    boost::asio::io_context::executor_type
+  >;
+
+  boost::asio::io_service _io_service;
+  work_guard_t _work_guard;
+  std::thread _io_thread;
+  udp::socket _socket;
+  udp::socket _socket_v6;
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+  local_datagram::socket _local_socket;
+#endif
+  boost::asio::steady_timer _drain_timer;
+  bool _is_stopping = false;
+  // Drain ticks in a row that found nothing queued.
+  size_t _idle_ticks = 0;
+  std::mutex _clients_mutex;
+  std::vector<Client*> _clients;
+  std::vector<OSCSendBuffer> _buffers;
+  std::vector<OSCSendBuffer*> _free_buffers;
+#if defined(OSC_USE_SENDMMSG)
+  std::vector<PendingPacket> _batch;
+  std::vector<mmsghdr> _headers;
+  std::vector<iovec> _iovecs;
+  std::vector<PendingPacket*> _header_packets;
+#endif
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "OSCLog.cpp"
+#include "OSCSender.cpp"
+#include <boost/asio.hpp>
+#include <exception>
+#include <string>
+
+const std::string kLocalUrlPrefix = "unix:";
+
+// "unix:/path/to/socket" sends to a receiver on the same host over an
+// AF_UNIX datagram socket, skipping the IP stack.
+inline bool parseLocalDestination(const std::string& path, OSCDestinations& destinations) {
+#if defined(OSC_HAS_LOCAL_SOCKETS)
+  if (path.empty()) {
+    DEBUG("Malformed string '%s' has no path", kLocalUrlPrefix.c_str());
+    return false;
+  }
+
+  local_datagram::endpoint endpoint;
+  try {
+    endpoint = local_datagram::endpoint(path);
+  }
+  catch (const std::exception& e) {
+    DEBUG("Path is wrong %s", path.c_str());
+    return false;
+  }
+
+  DEBUG("Local endpoint created %s", path.c_str());
+  destinations.localEndpoints.push_back(endpoint);
+  return true;
+#else
+  DEBUG("Local sockets are not supported on this platform");
+  return false;
+#endif
+}
+
+// One "ip:port", "[ipv6]:port" or "unix:/path" entry.
+inline bool parseDestination(const std::string& entry, OSCDestinations& destinations) {
+  using boost::asio::ip::udp;
+  using boost::asio::ip::address;
+  using boost::asio::ip::make_address;
+
+  if (entry.compare(0, kLocalUrlPrefix.size(), kLocalUrlPrefix) == 0)
+    return parseLocalDestination(entry.substr(kLocalUrlPrefix.size()), destinations);
+
+  std::string ip;
+  std::string portStr;
+
+  size_t colon = entry.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == entry.size()) {
+    DEBUG("Malformed string '%s' needs ip:port", entry.c_str());
+    return false;
+  }
+  ip = entry.substr(0, colon);
+  portStr = entry.substr(colon + 1);
+
+  if (ip.front() == '[' && ip.back() == ']') {
+    ip = ip.substr(1, ip.size() - 2);
+  }
+  else if (ip.find(':') != std::string::npos) {
+    DEBUG("Malformed string '%s' needs brackets around IPv6", entry.c_str());
+    return false;
+  }
+
+  address parsed;
+  try {
+    parsed = make_address(ip);
+  }
+  catch (const std::exception& e) {
+    DEBUG("Address is wrong %s", ip.c_str());
+    return false;
+  }
+
+  int port;
+  try {
+    port = std::stoi(portStr);
+  }
+  catch (const std::exception& e) {
+    DEBUG("Port is wrong %s", portStr.c_str());
+    return false;
+  }
+  if (port < 0 || port > 65535) {
+    DEBUG("Port is wrong %s", portStr.c_str());
+    return false;
+  }
+
+  DEBUG("Endpoint created %s:%d", ip.c_str(), port);
+  destinations.endpoints.push_back(udp::endpoint(parsed, port));
+  return true;
+}
+
+// The URL is a comma separated list of destinations, each one either
+// "ip:port" (IPv6 as "[ip]:port", multicast and broadcast addresses
+// included) or "unix:/path/to/socket" for a receiver on the same host.
+// Returns false, leaving destinations partly filled, if any entry is
+// malformed or there are more than kMaxDestinations.
+inline bool parseDestinations(const std::string& url, OSCDestinations& destinations) {
+  size_t begin = 0;
+  while (begin <= url.size()) {
+    size_t end = url.find(',', begin);
+    if (end == std::string::npos)
+      end = url.size();
+
+    size_t first = url.find_first_not_of(' ', begin);
+    size_t last = url.find_last_not_of(' ', end - 1);
+    if (first == std::string::npos || first >= end || end == 0) {
+      DEBUG("Malformed string '%s' has an empty entry", url.c_str());
+      return false;
+    }
+    if (!parseDestination(url.substr(first, last - first + 1), destinations))
+      return false;
+
+    begin = end + 1;
+  }
+
+  if (destinations.size() > kMaxDestinations) {
+    DEBUG("Too many destinations %zu", destinations.size());
+    return false;
+  }
+  return true;
+}
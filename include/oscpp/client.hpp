@@ -251,6 +251,23 @@ public:
         return *this;
     }
 
+    //! Write float message arguments.
+    /*!
+     * Write n 32 bit float arguments (n 'f' tags) with one bounds check
+     * per stream. Wrap in openArray()/closeArray() to send an OSC array.
+     *
+     * \pre openMessage must have been called before with no intervening
+     * closeMessage.
+     *
+     * \throw OSCPP::XRunError stream buffer xrun.
+     */
+    Packet& float32(const float* args, size_t n)
+    {
+        m_tags.putChars('f', n);
+        m_args.putFloat32Array(args, n);
+        return *this;
+    }
+
     Packet& string(const char* arg)
     {
         m_tags.putChar('s');
@@ -28,8 +28,17 @@
 #include <oscpp/detail/endian.hpp>
 
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
 
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#elif defined(__SSSE3__)
+#    include <tmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    include <arm_neon.h>
+#endif
+
 namespace OSCPP {
 #if defined(__GNUC__)
 inline static uint32_t bswap32(uint32_t x)
@@ -113,6 +122,83 @@ template <> inline uint64_t convert64<HostByteOrder>(uint64_t x)
 {
     return x;
 }
+
+//! Byte swap an array of 32 bit words.
+/*!
+ * Uses byte shuffles on SSSE3/AVX2 and NEON, the scalar loop handles the
+ * tail and other targets. dst and src may alias but must not overlap
+ * otherwise; neither needs to be aligned.
+ */
+inline void bswap32Array(void* dst, const void* src, size_t n)
+{
+    char*       d = static_cast<char*>(dst);
+    const char* s = static_cast<const char*>(src);
+    size_t      i = 0;
+
+#if defined(__AVX2__)
+    const __m256i mask8 =
+        _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i x =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 4 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 4 * i),
+                            _mm256_shuffle_epi8(x, mask8));
+    }
+#endif
+#if defined(__SSSE3__)
+    const __m128i mask4 =
+        _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128i x =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 4 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + 4 * i),
+                         _mm_shuffle_epi8(x, mask4));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= n; i += 4)
+    {
+        const uint8x16_t x =
+            vld1q_u8(reinterpret_cast<const uint8_t*>(s + 4 * i));
+        vst1q_u8(reinterpret_cast<uint8_t*>(d + 4 * i), vrev32q_u8(x));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        uint32_t x;
+        std::memcpy(&x, s + 4 * i, 4);
+        x = bswap32(x);
+        std::memcpy(d + 4 * i, &x, 4);
+    }
+}
+
+//! Convert an array of 32 bit words from host to byte order B.
+template <ByteOrder B>
+inline void convert32Array(void*, const void*, size_t)
+{
+    throw std::logic_error("Invalid byte order");
+}
+
+template <>
+inline void convert32Array<NetworkByteOrder>(void* dst, const void* src,
+                                             size_t n)
+{
+#if defined(OSCPP_LITTLE_ENDIAN)
+    bswap32Array(dst, src, n);
+#else
+    std::memmove(dst, src, 4 * n);
+#endif
+}
+
+template <>
+inline void convert32Array<HostByteOrder>(void* dst, const void* src,
+                                          size_t n)
+{
+    std::memmove(dst, src, 4 * n);
+}
 } // namespace OSCPP
 
 #endif // OSCPP_HOST_HPP_INCLUDED
@@ -184,6 +184,13 @@ public:
         advance(1);
     }
 
+    void putChars(char c, size_t n)
+    {
+        checkWritable(n);
+        std::memset(pos(), c, n);
+        advance(n);
+    }
+
     void putInt32(int32_t x)
     {
         checkWritable(4);
@@ -214,6 +221,16 @@ public:
         advance(4);
     }
 
+    // Write n floats with a single capacity check; the byte order
+    // conversion is vectorized where the target allows it.
+    void putFloat32Array(const float* f, size_t n)
+    {
+        checkWritable(4 * n);
+        checkAlignment(4);
+        convert32Array<B>(pos(), f, n);
+        advance(4 * n);
+    }
+
     void putFloat64(double f)
     {
         checkWritable(8);
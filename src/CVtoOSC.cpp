@@ -1,7 +1,6 @@
 #include "plugin.hpp"
 
 #include <memory>
-#include <nonstd/optional.hpp>
 #include <queue>
 #include <exception>
 
@@ -12,21 +11,31 @@
 #include <boost/array.hpp>
 
 #include "OSCSender.cpp"
+#include "OSCSampler.cpp"
+#include "OSCUrl.cpp"
 
-#define MICROS_PER_SEC         1000000
-#define us2s(x) (((double)x)/(double)MICROS_PER_SEC)
+// Labels for kDeadBands and kKeepalives in OSCSampler.cpp.
+const std::vector<std::string> kDeadBandLabels = {
+  "Off", "1 mV", "5 mV", "10 mV", "50 mV", "100 mV"
+};
+const std::vector<std::string> kKeepaliveLabels = {
+  "100 ms", "500 ms", "1 s", "2 s", "5 s"
+};
 
-timeval getCurrentTime() {
-  struct timeval tv{};
-  gettimeofday(&tv, nullptr);
-  return tv;
-}
+const float kLookaheads[] = {0.f, 0.005f, 0.01f, 0.02f, 0.05f, 0.1f};
+const std::vector<std::string> kLookaheadLabels = {
+  "Off", "5 ms", "10 ms", "20 ms", "50 ms", "100 ms"
+};
 
-struct CVtoOSC : Module {
-  rack::dsp::TTimer<float> timer;
-  rack::dsp::SchmittTrigger sendTrigger;
-  // float lastReset = 0.f;
+const std::vector<std::string> kProtocolLabels = {
+  "UDP", "TCP (SLIP, OSC 1.1)", "TCP (size prefix, OSC 1.0)"
+};
 
+const std::vector<std::string> kOverflowPolicyLabels = {
+  "Drop oldest", "Drop newest"
+};
+
+struct CVtoOSC : Module {
   std::string url;
   bool isUrlDirty = false;
   bool isUrlValid = false;
@@ -36,6 +45,11 @@ struct CVtoOSC : Module {
 
   std::unique_ptr<OSCSender> oscSender;
 
+  OSCSampler sampler;
+  int lookahead = 0;
+  int protocol = OSC_UDP;
+  int overflowPolicy = OSC_DROP_OLDEST;
+
   enum ParamId {
     SAMPLE_RATE_PARAM,
     PARAMS_LEN
@@ -63,17 +77,28 @@ struct CVtoOSC : Module {
   }
 
   void onAdd(const AddEvent &e) override {
+    oscSender->setTraceLabel(string::f("CVtoOSC %lld", (long long) id));
     oscSender->start();
   }
 
+  void onSampleRateChange(const SampleRateChangeEvent &e) override {
+    sampler.resetClock();
+  }
+
   void onReset(const ResetEvent &e) override {
-    timer.reset();
+    sampler.reset();
+
+    sampler.deadBand[0] = 0;
+    sampler.deadBand[1] = 0;
+    sampler.keepalive = kDefaultKeepalive;
+    setLookahead(0);
+    setProtocol(OSC_UDP);
+    setOverflowPolicy(OSC_DROP_OLDEST);
 
     url = "";
     isUrlDirty = true;
 
-    address1 = "";
-    isAddress1Dirty = true;
+    setAddress1("");
   }
 
   void fromJson(json_t *rootJ) override {
@@ -85,7 +110,7 @@ struct CVtoOSC : Module {
 
     json_t *address1J = json_object_get(rootJ, "address1");
     if (address1J)
-      address1 = json_string_value(address1J);
+      setAddress1(json_string_value(address1J));
     isAddress1Dirty = true;
   }
 
@@ -97,6 +122,24 @@ struct CVtoOSC : Module {
       "address1",
       json_stringn(address1.c_str(), address1.size())
     );
+    json_object_set_new(rootJ, "deadBand1", json_integer(sampler.deadBand[0]));
+    json_object_set_new(rootJ, "deadBand2", json_integer(sampler.deadBand[1]));
+    json_object_set_new(rootJ, "keepalive", json_integer(sampler.keepalive));
+    json_object_set_new(rootJ, "lookahead", json_integer(lookahead));
+    json_object_set_new(rootJ, "protocol", json_integer(protocol));
+    json_object_set_new(rootJ, "overflowPolicy", json_integer(overflowPolicy));
+
+    // Saved so a patch from a glitchy show carries the sender's state.
+    // Only written, the counters start over when the patch is loaded.
+    OSCSenderCounters counters = oscSender->counters();
+    json_t *countersJ = json_object();
+    json_object_set_new(countersJ, "packets", json_integer(counters.packets));
+    json_object_set_new(countersJ, "bytes", json_integer(counters.bytes));
+    json_object_set_new(countersJ, "sendErrors", json_integer(counters.sendErrors));
+    json_object_set_new(countersJ, "dropped", json_integer(counters.dropped));
+    json_object_set_new(countersJ, "encodeErrors", json_integer(counters.encodeErrors));
+    json_object_set_new(countersJ, "queueHighWater", json_integer(counters.queueHighWater));
+    json_object_set_new(rootJ, "counters", countersJ);
     return rootJ;
   }
 
@@ -108,79 +151,62 @@ struct CVtoOSC : Module {
 
     json_t *address1J = json_object_get(rootJ, "address1");
     if (address1J)
-      address1 = json_string_value(address1J);
+      setAddress1(json_string_value(address1J));
     isAddress1Dirty = true;
-  }
-
-  void onUrlUpdate(const std::string &newUrl) {
-    DEBUG("on url update %s", newUrl.c_str());
-    using boost::asio::ip::udp;
-    using boost::asio::ip::address;
-    using boost::asio::ip::make_address;
 
-    url = newUrl;
-    isUrlDirty = false;
+    json_t *deadBand1J = json_object_get(rootJ, "deadBand1");
+    if (deadBand1J)
+      sampler.deadBand[0] = clamp((int) json_integer_value(deadBand1J), 0, (int) kDeadBandLabels.size() - 1);
+    json_t *deadBand2J = json_object_get(rootJ, "deadBand2");
+    if (deadBand2J)
+      sampler.deadBand[1] = clamp((int) json_integer_value(deadBand2J), 0, (int) kDeadBandLabels.size() - 1);
+    json_t *keepaliveJ = json_object_get(rootJ, "keepalive");
+    if (keepaliveJ)
+      sampler.keepalive = clamp((int) json_integer_value(keepaliveJ), 0, (int) kKeepaliveLabels.size() - 1);
+    json_t *lookaheadJ = json_object_get(rootJ, "lookahead");
+    if (lookaheadJ)
+      setLookahead(clamp((int) json_integer_value(lookaheadJ), 0, (int) kLookaheadLabels.size() - 1));
+    json_t *protocolJ = json_object_get(rootJ, "protocol");
+    if (protocolJ)
+      setProtocol(clamp((int) json_integer_value(protocolJ), 0, (int) kProtocolLabels.size() - 1));
+    json_t *overflowPolicyJ = json_object_get(rootJ, "overflowPolicy");
+    if (overflowPolicyJ)
+      setOverflowPolicy(clamp((int) json_integer_value(overflowPolicyJ), 0, (int) kOverflowPolicyLabels.size() - 1));
+  }
 
-    std::string ip;
-    std::string portStr;
-    bool hasIp = false;
-    bool hasPort = false;
+  void setLookahead(int index) {
+    lookahead = index;
+    oscSender->setLookahead(kLookaheads[index]);
+  }
 
-    u_int32_t l = url.length();
-    for (u_int32_t i = 0; i < l; i++) {
-      if (url[i] == ':' && hasIp) {
-        hasPort = false;
-        continue;
-      }
+  void setProtocol(int index) {
+    protocol = index;
+    oscSender->setProtocol((OSCProtocol) index);
+  }
 
-      if (url[i] == ':' && !hasIp) {
-        hasIp = true;
-        continue;
-      }
+  void setOverflowPolicy(int index) {
+    overflowPolicy = index;
+    oscSender->setOverflowPolicy((OSCOverflowPolicy) index);
+  }
 
-      if (hasIp) {
-        portStr.push_back(url[i]);
-        hasPort = true;
-        continue;
-      }
+  void setAddress1(const std::string &newAddress) {
+    address1 = newAddress;
+    oscSender->setAddress(address1);
+  }
 
-      ip.push_back(url[i]);
-    }
+  // See parseDestinations() for the format.
+  void onUrlUpdate(const std::string &newUrl) {
+    DEBUG("on url update %s", newUrl.c_str());
 
-    nonstd::optional<boost::asio::ip::udp::endpoint> endpoint;
+    url = newUrl;
+    isUrlDirty = false;
     isUrlValid = false;
 
-    if (!hasPort || !hasIp) {
-      DEBUG(
-        "Malformed string '%s' hasIp? %d hasPort? %d",
-        url.c_str(),
-        hasIp,
-        hasPort
-      );
+    OSCDestinations destinations;
+    if (!parseDestinations(url, destinations))
       return;
-    }
-
-    address parsed;
-    try {
-      parsed = make_address(ip);
-    }
-    catch (const std::exception &e) {
-      DEBUG("Address is wrong %s", ip.c_str());
-      return;
-    }
-
-    int port;
-    try {
-      port = stoi(portStr);
-    }
-    catch (const std::exception &e) {
-      DEBUG("Port is wrong %s", portStr.c_str());
-      return;
-    }
 
-    DEBUG("Endpoint created %s:%d", ip.c_str(), port);
-    endpoint = udp::endpoint(parsed, port);
-    oscSender->setEndpoint(std::move(endpoint.value()));
+    oscSender->setDestinations(destinations);
     isUrlValid = true;
   }
 
@@ -190,70 +216,22 @@ struct CVtoOSC : Module {
   }
 
   void process(const ProcessArgs &args) override {
-    float cv1 = (clamp(
-      inputs[CV1_INPUT].getVoltage(),
-      -10.f,
-      10.f
-    ) + 10.f) / 20.f;
-    float cv2 = (clamp(
-      inputs[CV2_INPUT].getVoltage(),
-      -10.f,
-      10.f
-    ) + 10.f) / 20.f;
-    float sampleRateParam = params[SAMPLE_RATE_PARAM].getValue();
-    auto sendInput = inputs[SEND_TRIG_INPUT];
-
-    if (
-      sendInput.isConnected() &&
-      !sendTrigger.process(
-        rescale(
-          sendInput.getVoltage(),
-          0.0f,
-          5.0f,
-          0.f,
-          1.f
-        )
-      )
-    ) {
-      return;
-    }
-
-    timer.process(args.sampleTime);
-    if (
-      !sendInput.isConnected() &&
-      timer.getTime() < sampleRateParam
-    ) {
-      // DEBUG("t %f, lr %f, sr %f", timer.getTime(), lastReset, sampleRateParam);
-      return;
+    OSCSamplerFrame frame;
+    for (int i = 0; i < 2; i++) {
+      Input &input = inputs[CV1_INPUT + i];
+      frame.voltages[i] = input.getVoltages();
+      frame.channels[i] = input.getChannels();
     }
-
-    timer.reset();
-
-
-    OSCMessageValue val1{
-      .type = OSCMessageValue::FLOAT,
-      .f = cv1
-    };
-
-    OSCMessageValue val2{
-      .type = OSCMessageValue::FLOAT,
-      .f = cv2
-    };
-
-
-    OSCMessage msg1{
-      .address = address1,
-      .valuesSize = 2,
-      .values = new OSCMessageValue[2]{val1, val2}
-    };
-
-    OSCBundle bundle{
-      .time = getCurrentTime(),
-      .messagesSize = 1,
-      .messages = new OSCMessage[1]{msg1},
-    };
-
-    oscSender->send(bundle);
+    frame.isTriggerConnected = inputs[SEND_TRIG_INPUT].isConnected();
+    frame.trigger = inputs[SEND_TRIG_INPUT].getVoltage();
+    frame.period = params[SAMPLE_RATE_PARAM].getValue();
+    frame.sampleTime = args.sampleTime;
+    frame.sampleRate = args.sampleRate;
+    frame.frame = args.frame;
+
+    OSCSample sample;
+    if (sampler.process(frame, sample))
+      oscSender->push(sample);
   }
 };
 
@@ -414,7 +392,7 @@ struct AddressTextField : LedDisplayTextField {
 
   void onChange(const ChangeEvent &e) override {
     if (module)
-      module->address1 = getText();
+      module->setAddress1(getText());
   }
 };
 
@@ -516,6 +494,107 @@ struct CVtoOSCWidget : ModuleWidget {
     addParam(createParam<Trimpot>(Vec(RACK_GRID_WIDTH + 96, 176), module, CVtoOSC::SAMPLE_RATE_PARAM));
     addInput(createInputCentered<PJ301MPort>(Vec(RACK_GRID_WIDTH + 96 + 32, 184), module, CVtoOSC::SEND_TRIG_INPUT));
   }
+
+  void appendContextMenu(Menu *menu) override {
+    auto *module = dynamic_cast<CVtoOSC *>(this->module);
+    if (!module)
+      return;
+
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createIndexSubmenuItem(
+      "Protocol",
+      kProtocolLabels,
+      [=]() { return module->protocol; },
+      [=](size_t index) { module->setProtocol((int) index); }
+    ));
+    menu->addChild(createIndexSubmenuItem(
+      "When falling behind",
+      kOverflowPolicyLabels,
+      [=]() { return module->overflowPolicy; },
+      [=](size_t index) { module->setOverflowPolicy((int) index); }
+    ));
+
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createMenuLabel("Change detection (free-running)"));
+    menu->addChild(
+      createIndexPtrSubmenuItem("CV1 dead band", kDeadBandLabels, &module->sampler.deadBand[0])
+    );
+    menu->addChild(
+      createIndexPtrSubmenuItem("CV2 dead band", kDeadBandLabels, &module->sampler.deadBand[1])
+    );
+    menu->addChild(
+      createIndexPtrSubmenuItem("Keepalive", kKeepaliveLabels, &module->sampler.keepalive)
+    );
+
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createMenuLabel("Timing"));
+    menu->addChild(createIndexSubmenuItem(
+      "Timetag lookahead",
+      kLookaheadLabels,
+      [=]() { return module->lookahead; },
+      [=](size_t index) { module->setLookahead((int) index); }
+    ));
+    menu->addChild(createMenuLabel(string::f(
+      "Send latency: %.2f ms avg, %.2f ms max",
+      module->oscSender->latencyAverage() / 1000.f,
+      module->oscSender->latencyMax() / 1000.f
+    )));
+
+    OSCSenderCounters counters = module->oscSender->counters();
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createMenuLabel("Sender"));
+    menu->addChild(createMenuLabel(string::f(
+      "%llu packets, %.1f kB sent",
+      (unsigned long long) counters.packets,
+      counters.bytes / 1000.f
+    )));
+    menu->addChild(createMenuLabel(string::f(
+      "%llu send errors, %llu dropped, %llu encode errors",
+      (unsigned long long) counters.sendErrors,
+      (unsigned long long) counters.dropped,
+      (unsigned long long) counters.encodeErrors
+    )));
+    menu->addChild(createMenuLabel(string::f(
+      "Queue peak %zu of %zu samples",
+      counters.queueHighWater,
+      kSampleQueueSize
+    )));
+
+    menu->addChild(createBoolMenuItem(
+      "Record timing histograms",
+      "",
+      [=]() { return module->oscSender->isTiming(); },
+      [=](bool isTiming) { module->oscSender->setTiming(isTiming); }
+    ));
+    menu->addChild(createMenuItem(
+      "Write timing histograms",
+      "",
+      [=]() {
+        std::string path = asset::user(
+          string::f("Akkusativ-CVtoOSC-%lld-timing.txt", (long long) module->id)
+        );
+        if (module->oscSender->writeTiming(path))
+          DEBUG("timing written to %s", path.c_str());
+      }
+    ));
+
+    // The tracer is shared, it covers every OSC module and the I/O thread.
+    menu->addChild(createBoolMenuItem(
+      "Record trace (all modules)",
+      "",
+      []() { return OSCTracer::isEnabled(); },
+      [](bool isEnabled) { OSCTracer::instance().setEnabled(isEnabled); }
+    ));
+    menu->addChild(createMenuItem(
+      "Write Chrome trace",
+      "",
+      []() {
+        std::string path = asset::user("Akkusativ-OSC-trace.json");
+        if (OSCTracer::instance().writeChromeTrace(path))
+          DEBUG("trace written to %s", path.c_str());
+      }
+    ));
+  }
 };
 
 Model *modelCVtoOSC = createModel<CVtoOSC, CVtoOSCWidget>("CVtoOSC");
@@ -0,0 +1,316 @@
+#include "plugin.hpp"
+
+#include <memory>
+#include <exception>
+
+#include "OSCReceiver.cpp"
+#include "OSCJitterBuffer.cpp"
+
+// Index 0 applies every value as soon as it arrives, the others hold
+// timetagged values back until their timetag plus the delay.
+const float kPlayoutDelays[] = {0.f, 0.f, 0.005f, 0.01f, 0.02f, 0.05f, 0.1f};
+const std::vector<std::string> kPlayoutDelayLabels = {
+  "Off", "Timetag + 0 ms", "Timetag + 5 ms", "Timetag + 10 ms",
+  "Timetag + 20 ms", "Timetag + 50 ms", "Timetag + 100 ms"
+};
+
+struct OSCtoCV : Module {
+  std::string port;
+  bool isPortDirty = false;
+  bool isPortValid = false;
+
+  std::string address1;
+  bool isAddress1Dirty = false;
+
+  std::unique_ptr<OSCReceiver> oscReceiver;
+
+  int playoutDelay = 0;
+  int activePlayoutDelay = 0;
+  OSCJitterBuffer jitterBuffer;
+
+  enum ParamId {
+    PARAMS_LEN
+  };
+  enum InputId {
+    INPUTS_LEN
+  };
+  enum OutputId {
+    CV1_OUTPUT,
+    CV2_OUTPUT,
+    OUTPUTS_LEN
+  };
+  enum LightId {
+    LIGHTS_LEN
+  };
+
+  OSCtoCV() {
+    config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+    configOutput(CV1_OUTPUT, "CV1");
+    configOutput(CV2_OUTPUT, "CV2");
+    oscReceiver = std::unique_ptr<OSCReceiver>(new OSCReceiver());
+  }
+
+  void onAdd(const AddEvent &e) override {
+    oscReceiver->start();
+  }
+
+  void onRemove(const RemoveEvent &e) override {
+    oscReceiver->stop();
+    DEBUG("onRemove done");
+  }
+
+  void onSampleRateChange(const SampleRateChangeEvent &e) override {
+    jitterBuffer.resetClock();
+  }
+
+  void onReset(const ResetEvent &e) override {
+    setPlayoutDelay(0);
+
+    port = "";
+    isPortDirty = true;
+
+    setAddress1("");
+    isAddress1Dirty = true;
+  }
+
+  json_t *dataToJson() override {
+    json_t *rootJ = json_object();
+    json_object_set_new(rootJ, "port", json_stringn(port.c_str(), port.size()));
+    json_object_set_new(
+      rootJ,
+      "address1",
+      json_stringn(address1.c_str(), address1.size())
+    );
+    json_object_set_new(rootJ, "playoutDelay", json_integer(playoutDelay));
+    return rootJ;
+  }
+
+  void dataFromJson(json_t *rootJ) override {
+    json_t *portJ = json_object_get(rootJ, "port");
+    if (portJ)
+      port = json_string_value(portJ);
+    isPortDirty = true;
+
+    json_t *address1J = json_object_get(rootJ, "address1");
+    if (address1J)
+      setAddress1(json_string_value(address1J));
+    isAddress1Dirty = true;
+
+    json_t *playoutDelayJ = json_object_get(rootJ, "playoutDelay");
+    if (playoutDelayJ)
+      setPlayoutDelay(clamp((int) json_integer_value(playoutDelayJ), 0, (int) kPlayoutDelayLabels.size() - 1));
+  }
+
+  // Called from the UI thread, the engine thread notices the change and
+  // flushes whatever is still scheduled.
+  void setPlayoutDelay(int index) {
+    playoutDelay = index;
+    oscReceiver->setScheduling(index > 0);
+  }
+
+  void setAddress1(const std::string &newAddress) {
+    address1 = newAddress;
+    oscReceiver->setAddress(address1);
+  }
+
+  void onPortUpdate(const std::string &newPort) {
+    DEBUG("on port update %s", newPort.c_str());
+    port = newPort;
+    isPortDirty = false;
+    isPortValid = false;
+
+    int parsed;
+    try {
+      parsed = stoi(port);
+    }
+    catch (const std::exception &e) {
+      DEBUG("Port is wrong %s", port.c_str());
+      oscReceiver->setPort(0);
+      return;
+    }
+    if (parsed < 1 || parsed > 65535) {
+      DEBUG("Port is wrong %s", port.c_str());
+      oscReceiver->setPort(0);
+      return;
+    }
+
+    oscReceiver->setPort((uint16_t) parsed);
+    isPortValid = true;
+  }
+
+  void process(const ProcessArgs &args) override {
+    const OSCSample *sample = oscReceiver->consume();
+    if (sample)
+      apply(*sample);
+
+    const int delay = playoutDelay;
+    if (delay != activePlayoutDelay) {
+      activePlayoutDelay = delay;
+      jitterBuffer.setDelay(kPlayoutDelays[delay]);
+      while (!jitterBuffer.empty()) {
+        apply(jitterBuffer.top());
+        jitterBuffer.pop();
+      }
+      OSCSample stale;
+      while (oscReceiver->consumeScheduled(stale)) {
+        apply(stale);
+      }
+    }
+    if (delay == 0)
+      return;
+
+    jitterBuffer.advance(args.frame, args.sampleRate);
+    OSCSample scheduled;
+    while (oscReceiver->consumeScheduled(scheduled)) {
+      // Out of room, the earliest value goes out ahead of time.
+      if (jitterBuffer.isFull()) {
+        apply(jitterBuffer.top());
+        jitterBuffer.pop();
+      }
+      jitterBuffer.push(scheduled);
+    }
+    while (jitterBuffer.isDue()) {
+      apply(jitterBuffer.top());
+      jitterBuffer.pop();
+    }
+  }
+
+  // Outputs keep their voltages between frames, so they are only written
+  // when a value is due. Values are 0..1 and map back to -10..10V, the
+  // inverse of what CVtoOSC sends.
+  void apply(const OSCSample &sample) {
+    size_t offset = 0;
+    for (int i = 0; i < 2; i++) {
+      Output &output = outputs[CV1_OUTPUT + i];
+      int channels = sample.channels[i];
+      output.setChannels(std::max(channels, 1));
+      if (channels == 0)
+        output.setVoltage(0.f);
+
+      for (int c = 0; c < channels; c++) {
+        output.setVoltage(sample.values[offset + c] * 20.f - 10.f, c);
+      }
+      offset += channels;
+    }
+  }
+};
+
+struct ReceivePortTextField : LedDisplayTextField {
+  OSCtoCV *module{};
+
+  ReceivePortTextField() {
+    placeholder = "Port, e.g. 7500";
+  }
+
+  void step() override {
+    LedDisplayTextField::step();
+    if (!module || !module->isPortDirty)
+      return;
+    module->onPortUpdate(module->port);
+    setText(module->port);
+  }
+
+  void onChange(const ChangeEvent &e) override {
+    if (module)
+      module->onPortUpdate(getText());
+  }
+};
+
+struct ReceivePortDisplay : LedDisplay {
+  void setModule(OSCtoCV *module) {
+    auto *textField = createWidget<ReceivePortTextField>(Vec(0, 0));
+    textField->box.size = box.size;
+    textField->multiline = false;
+    textField->module = module;
+    addChild(textField);
+  }
+};
+
+struct ReceiveAddressTextField : LedDisplayTextField {
+  OSCtoCV *module{};
+
+  ReceiveAddressTextField() {
+    placeholder = "Addresses or patterns";
+  }
+
+  void step() override {
+    LedDisplayTextField::step();
+    if (!module || !module->isAddress1Dirty)
+      return;
+    setText(module->address1);
+    module->isAddress1Dirty = false;
+  }
+
+  void onChange(const ChangeEvent &e) override {
+    if (module)
+      module->setAddress1(getText());
+  }
+};
+
+struct ReceiveAddressDisplay : LedDisplay {
+  void setModule(OSCtoCV *module) {
+    auto *textField = createWidget<ReceiveAddressTextField>(Vec(0, 0));
+    textField->box.size = box.size;
+    textField->multiline = false;
+    textField->module = module;
+    addChild(textField);
+  }
+};
+
+struct OSCtoCVWidget : ModuleWidget {
+  explicit OSCtoCVWidget(OSCtoCV *module) {
+    setModule(module);
+    setPanel(
+      createPanel(asset::plugin(pluginInstance, "res/Akkusativ_OSC_CV.svg"))
+    );
+
+    addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+    addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+    addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+    addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+    float h = 0;
+
+    auto *portDisplay = createWidget<ReceivePortDisplay>(Vec(0, h += 52));
+    portDisplay->box.size = Vec(180, 32);
+    portDisplay->setModule(module);
+    addChild(portDisplay);
+
+    auto *address1Display = createWidget<ReceiveAddressDisplay>(Vec(0, h += 32));
+    address1Display->box.size = Vec(180, 32);
+    address1Display->setModule(module);
+    addChild(address1Display);
+
+    addOutput(createOutputCentered<PJ301MPort>(Vec(RACK_GRID_WIDTH, 184), module, OSCtoCV::CV1_OUTPUT));
+    addOutput(createOutputCentered<PJ301MPort>(Vec(RACK_GRID_WIDTH + 32, 184), module, OSCtoCV::CV2_OUTPUT));
+  }
+
+  void appendContextMenu(Menu *menu) override {
+    auto *module = dynamic_cast<OSCtoCV *>(this->module);
+    if (!module)
+      return;
+
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createIndexSubmenuItem(
+      "Playout",
+      kPlayoutDelayLabels,
+      [=]() { return module->playoutDelay; },
+      [=](size_t index) { module->setPlayoutDelay((int) index); }
+    ));
+    menu->addChild(createMenuLabel(string::f(
+      "%llu values arrived after their playout time",
+      (unsigned long long) module->jitterBuffer.late()
+    )));
+
+    menu->addChild(new MenuSeparator);
+    menu->addChild(createMenuLabel(string::f(
+      "%s, %llu messages, %llu errors, %llu dropped",
+      module->oscReceiver->isListening() ? "Listening" : "Not listening",
+      (unsigned long long) module->oscReceiver->received(),
+      (unsigned long long) module->oscReceiver->errors(),
+      (unsigned long long) module->oscReceiver->dropped()
+    )));
+  }
+};
+
+Model *modelOSCtoCV = createModel<OSCtoCV, OSCtoCVWidget>("OSCtoCV");